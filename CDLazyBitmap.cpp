@@ -18,8 +18,10 @@
 
 #if DEBUG
     #define CLOSE_AND_RETURN(error) {/* DumpFile(&file); */m_file.close(); Serial.println(error); return; }
+    #define CLOSE_AND_RETURN_VALUE(error, value) { m_file.close(); Serial.println(error); return value; }
 #else
     #define CLOSE_AND_RETURN(error) { m_file.close(); return; }
+    #define CLOSE_AND_RETURN_VALUE(error, value) { m_file.close(); return value; }
 #endif
 
 #if defined(__MK20DX128__) || defined(__MK20DX256__)
@@ -81,11 +83,12 @@ void DumpFile(File *file) {
 void CDPatternBitmap::fillEntireBufferFromFile(CRGB *buffer) {
     switch (m_bInfo.biCompression) {
         case 0: {
-            fillEntireBufferFromFile_comp0(buffer);
+            fillBufferRowsFromFile_comp0(buffer, 0, m_height);
             break;
         }
         case 1: {
-            fillEntireBufferFromFile_comp1(buffer);
+            m_loadStarted = false;
+            fillBufferFromFile_comp1(buffer, 0);
             break;
         }
         default: {
@@ -95,14 +98,15 @@ void CDPatternBitmap::fillEntireBufferFromFile(CRGB *buffer) {
     }
 }
 
-void CDPatternBitmap::fillEntireBufferFromFile_comp0(CRGB *buffer) {
+// Fills rows startY up to (but not including) endY
+void CDPatternBitmap::fillBufferRowsFromFile_comp0(CRGB *buffer, uint32_t startY, uint32_t endY) {
 #if SD_CARD_SUPPORT
-    m_file.seekSet(m_dataOffset);
-
     // 4 byte aligned rows
     unsigned int lineWidth = ((m_width * m_bInfo.biBitCount / 8) + 3) & ~3;
     size_t size = sizeof(uint8_t) * lineWidth;
-    int x = 0;
+    int x = startY * m_width;
+    
+    m_file.seekSet(m_dataOffset + startY * lineWidth);
     
     // read in one line at a time from the file
     // TODO: Maybe a stack buffer to try?
@@ -110,7 +114,7 @@ void CDPatternBitmap::fillEntireBufferFromFile_comp0(CRGB *buffer) {
 
     // unroll the loops a bit; this replicates code for speed
     if (m_bInfo.biBitCount == 1) {
-        for (int y = 0; y < m_height; y++) {
+        for (int y = startY; y < endY; y++) {
             m_file.read((char*)lineBuffer, size);
             uint8_t *linePtr = lineBuffer;
             for (int j = 0; j < m_width; j++) {
@@ -130,7 +134,7 @@ void CDPatternBitmap::fillEntireBufferFromFile_comp0(CRGB *buffer) {
             }
         }
     } else if (m_bInfo.biBitCount == 4) {
-        for (int y = 0; y < m_height; y++) {
+        for (int y = startY; y < endY; y++) {
             m_file.read((char*)lineBuffer, size);
             uint8_t *linePtr = lineBuffer;
             for (int j = 0; j < m_width; j++) {
@@ -152,7 +156,7 @@ void CDPatternBitmap::fillEntireBufferFromFile_comp0(CRGB *buffer) {
             }
         }
     } else if (m_bInfo.biBitCount == 8) {
-        for (int y = 0; y < m_height; y++) {
+        for (int y = startY; y < endY; y++) {
             m_file.read((char*)lineBuffer, size);
             uint8_t *linePtr = lineBuffer;
             for (int j = 0; j < m_width; j++) {
@@ -169,7 +173,7 @@ void CDPatternBitmap::fillEntireBufferFromFile_comp0(CRGB *buffer) {
             }
         }
     } else if (m_bInfo.biBitCount == 16) {
-        for (int y = 0; y < m_height; y++) {
+        for (int y = startY; y < endY; y++) {
             m_file.read((char*)lineBuffer, size);
             uint8_t *linePtr = lineBuffer;
             for (int j = 0; j < m_width; j++) {
@@ -185,7 +189,7 @@ void CDPatternBitmap::fillEntireBufferFromFile_comp0(CRGB *buffer) {
             }
         }
     } else if (m_bInfo.biBitCount == 24) {
-        for (int y = 0; y < m_height; y++) {
+        for (int y = startY; y < endY; y++) {
             m_file.read((char*)lineBuffer, size);
             uint8_t *linePtr = lineBuffer;
             for (int j = 0; j < m_width; j++) {
@@ -203,7 +207,7 @@ void CDPatternBitmap::fillEntireBufferFromFile_comp0(CRGB *buffer) {
             }
         }
     } else if (m_bInfo.biBitCount == 32) {
-        for (int y = 0; y < m_height; y++) {
+        for (int y = startY; y < endY; y++) {
             m_file.read((char*)lineBuffer, size);
             uint8_t *linePtr = lineBuffer;
             for (int j = 0; j < m_width; j++) {
@@ -229,22 +233,34 @@ void CDPatternBitmap::fillEntireBufferFromFile_comp0(CRGB *buffer) {
 #endif
 }
 
-// Fills the entire buffer with CRGB data from the file
-void CDPatternBitmap::fillEntireBufferFromFile_comp1(CRGB *buffer) {
+// Fills the entire buffer with CRGB data from the file. It can be done in steps: maxRuns limits how many RLE records are decoded per call (0 is no limit), and it returns true once the whole picture has been read.
+bool CDPatternBitmap::fillBufferFromFile_comp1(CRGB *buffer, int maxRuns) {
 #if SD_CARD_SUPPORT
-    m_file.seekSet(m_dataOffset);
     size_t maxOffset = m_width*m_height;
+    if (!m_loadStarted) {
+        m_file.seekSet(m_dataOffset);
+        // assumes black..
+        bzero(buffer, sizeof(CRGB)*maxOffset);
+        m_loadX = 0;
+        m_loadY = 0;
+        m_loadStarted = true;
+    }
 
     uint8_t Count = 0;
     uint8_t ColorIndex = 0;
-    int x = 0, y = 0;
+    int x = m_loadX, y = m_loadY;
     int Index = 0;
-    
-    // assumes black..
-    bzero(buffer, sizeof(CRGB)*maxOffset);
+    int runs = 0;
 
     bool stop = false;
     while (!stop && m_file.available() > 0) {
+        if (maxRuns > 0 && runs == maxRuns) {
+            // pick it up from here next time
+            m_loadX = x;
+            m_loadY = y;
+            return false;
+        }
+        runs++;
         m_file.read((char*) &Count, sizeof(uint8_t));
         m_file.read((char*) &ColorIndex, sizeof(uint8_t));
         
@@ -299,6 +315,7 @@ void CDPatternBitmap::fillEntireBufferFromFile_comp1(CRGB *buffer) {
         }
     }
 #endif
+    return true;
 }
 
 void CDPatternBitmap::uncompressed_fillRGBBufferFromYOffset(CRGB *buffer, int y) {
@@ -478,6 +495,9 @@ uint32_t heap_free() {
 
 #endif
 
+// The bitmap whose data is in the shared buffer; a bitmap being loaded ahead of time has to wait for it to be released
+static CDPatternBitmap *g_sharedBufferOwner = NULL;
+
 // may return NULL if it couldn't be allocated
 static inline CRGB *getSharedBuffer() {
     CRGB *result = g_sharedBuffer;
@@ -525,7 +545,16 @@ uint8_t *CDPatternBitmap::getLineBufferAtOffset(size_t size, uint32_t dataOffset
 #endif
 }
 
-CDPatternBitmap::CDPatternBitmap(const char *filename, CRGB *buffer1, CRGB *buffer2, size_t bufferSize) : m_xOffset(0), m_yOffset(-1), m_bufferOwned(false), m_buffer1Owned(false), m_buffer2Owned(false), m_bufferIsEntireFile(false), m_bufferIsFullCRGBData(false), m_colorTable(NULL)  {
+CDPatternBitmap::CDPatternBitmap(const char *filename, CRGB *buffer1, CRGB *buffer2, size_t bufferSize) : m_colorTable(NULL), m_buffer(NULL), m_buffer1(NULL), m_buffer2(NULL), m_yOffset(-1), m_xOffset(0), m_buffer1Owned(false), m_buffer2Owned(false), m_bufferOwned(false), m_bufferIsEntireFile(false), m_bufferIsFullCRGBData(false), m_loadStarted(false), m_loadPlanned(false), m_loadDone(false), m_loadPosition(0), m_loadX(0), m_loadY(0)  {
+    openAndReadHeaders(filename);
+    finishLoading(buffer1, buffer2, bufferSize);
+}
+
+CDPatternBitmap::CDPatternBitmap(const char *filename) : m_colorTable(NULL), m_buffer(NULL), m_buffer1(NULL), m_buffer2(NULL), m_yOffset(-1), m_xOffset(0), m_buffer1Owned(false), m_buffer2Owned(false), m_bufferOwned(false), m_bufferIsEntireFile(false), m_bufferIsFullCRGBData(false), m_loadStarted(false), m_loadPlanned(false), m_loadDone(false), m_loadPosition(0), m_loadX(0), m_loadY(0)  {
+    openAndReadHeaders(filename);
+}
+
+void CDPatternBitmap::openAndReadHeaders(const char *filename) {
     
     DEBUG_PRINTF("Bitmap loading: %s\r\n", filename);
     
@@ -602,31 +631,30 @@ CDPatternBitmap::CDPatternBitmap(const char *filename, CRGB *buffer1, CRGB *buff
     
     m_dataOffset = fileHeader.bfOffBits;
     
-    // buffer allocation and loading
-    
-    m_buffer = getSharedBuffer();
-    if (m_buffer == NULL) {
-        CLOSE_AND_RETURN("No shared buffer!?");
-    }
-    
-#ifdef PATTERN_EDITOR
-    m_bufferOwned = true; // The pattern editor owns it
-#endif
-    
     m_isValid = true;
-    
+#endif
+}
+
+// Decides how the image data will be held, and gets the buffer for it: the shared buffer, or when another bitmap is still showing from it (ie: this one is being loaded ahead of time), one of its own if there is enough RAM. Returns false if it has to wait for the shared buffer.
+bool CDPatternBitmap::planLoading() {
+#if SD_CARD_SUPPORT
     // This complexity IS needed, as loading a line at a time from the SD card IS TOO SLOW
     size_t totalMemoryNeeded = sizeof(CRGB)*m_width*m_height;
     
     // Try to allocate one big buffer to hold it all in RAM
+    bool isFullCRGBData = false;
+    bool isEntireFile = false;
+    size_t bufferSizeNeeded;
     if (totalMemoryNeeded <= MAX_SIZE_SINGLE_BUFFER) {
-        m_bufferIsFullCRGBData = true;
-        fillEntireBufferFromFile(m_buffer);
+        isFullCRGBData = true;
+        bufferSizeNeeded = totalMemoryNeeded;
     } else if (m_bInfo.biCompression == 1) {
         // TODO: handle compression 1!!
         // if we are RLE, only do it if the entire thing can be in memory; otherwise it is going to be god awful slow disk access, and I want to know that is the issue by making it "invalid"
+        m_loadPlanned = true;
         m_isValid = false; // bad; not enough memory
         DEBUG_PRINTLN("not enough RAM for RLE 8 encoding");
+        return true;
     } else {
         // compression 0 (uncompressed) bitmaps  only!!
         
@@ -635,14 +663,132 @@ CDPatternBitmap::CDPatternBitmap(const char *filename, CRGB *buffer1, CRGB *buff
         // See if we can fit the SD card compressed data in the shared buffer so we don't load from the SD card a bunch
         uint32_t restDataSize = m_file.fileSize() - m_dataOffset;
         if (restDataSize <= MAX_SIZE_SINGLE_BUFFER) {
-            m_file.seekSet(m_dataOffset);
-            // suck it in
-            m_file.read((char*)m_buffer, restDataSize);
+            // The mark that we are doing this..
+            isEntireFile = true;
+            bufferSizeNeeded = restDataSize;
+        } else {
+            // Rows are read as it plays; the buffer is only used for one row
+            bufferSizeNeeded = sizeof(CRGB)*m_width;
+        }
+    }
+    
+#ifndef PATTERN_EDITOR
+    if (g_sharedBufferOwner != NULL && g_sharedBufferOwner != this) {
+        // Load into our own buffer, so all of it is read before the switch instead of at it
+        if (heap_free() < bufferSizeNeeded + 1024) {
+            return false; // wait for the shared buffer
+        }
+        m_buffer = (CRGB *)malloc(bufferSizeNeeded);
+        if (m_buffer == NULL) {
+            return false;
+        }
+        m_bufferOwned = true;
+    } else
+#endif
+    {
+        m_buffer = getSharedBuffer();
+        if (m_buffer == NULL) {
+            m_loadPlanned = true;
+            m_isValid = false;
+            CLOSE_AND_RETURN_VALUE("No shared buffer!?", true);
+        }
+#ifdef PATTERN_EDITOR
+        m_bufferOwned = true; // The pattern editor owns it
+#else
+        g_sharedBufferOwner = this;
+#endif
+    }
+    m_loadPlanned = true;
+    m_bufferIsFullCRGBData = isFullCRGBData;
+    m_bufferIsEntireFile = isEntireFile;
+#endif
+    return true;
+}
+
+bool CDPatternBitmap::prepareBuffer() {
+    if (m_isValid && !m_loadPlanned) {
+        planLoading();
+    }
+    return m_loadPlanned;
+}
+
+// Each step reads about this much from the card, so a step fits in a frame
+#define LOAD_STEP_SIZE 2048
+#define LOAD_STEP_RLE_RUNS 256
+
+bool CDPatternBitmap::loadStep() {
+#if SD_CARD_SUPPORT
+    if (!m_isValid || m_loadDone) {
+        return true;
+    }
+    if (!m_loadPlanned) {
+        if (!planLoading()) {
+            return false; // try again later
+        }
+        if (!m_isValid) {
+            return true;
+        }
+    }
+    
+    if (m_bufferIsFullCRGBData) {
+        if (m_bInfo.biCompression == 1) {
+            m_loadDone = fillBufferFromFile_comp1(m_buffer, LOAD_STEP_RLE_RUNS);
+        } else if (m_bInfo.biCompression == 0) {
+            unsigned int lineWidth = ((m_width * m_bInfo.biBitCount / 8) + 3) & ~3;
+            uint32_t rowCount = LOAD_STEP_SIZE / lineWidth;
+            if (rowCount == 0) {
+                rowCount = 1;
+            }
+            uint32_t endY = m_loadPosition + rowCount;
+            if (endY > m_height) {
+                endY = m_height;
+            }
+            fillBufferRowsFromFile_comp0(m_buffer, m_loadPosition, endY);
+            m_loadPosition = endY;
+            m_loadDone = m_loadPosition >= m_height;
+        } else {
+            fillEntireBufferFromFile(m_buffer); // marks it invalid
+            m_loadDone = true;
+        }
+    } else if (m_bufferIsEntireFile) {
+        // suck it in, a piece at a time
+        uint32_t restDataSize = m_file.fileSize() - m_dataOffset;
+        uint32_t amount = restDataSize - m_loadPosition;
+        if (amount > LOAD_STEP_SIZE) {
+            amount = LOAD_STEP_SIZE;
+        }
+        m_file.seekSet(m_dataOffset + m_loadPosition);
+        m_file.read((char*)m_buffer + m_loadPosition, amount);
+        m_loadPosition += amount;
+        if (m_loadPosition >= restDataSize) {
             m_file.close();
-            // The mark that we did this..
-            m_bufferIsEntireFile = true;
+            m_loadDone = true;
         }
-        
+    } else {
+        // Rows are read from the card as the pattern plays; nothing to do ahead of time
+        m_loadDone = true;
+    }
+    return m_loadDone;
+#else
+    return true;
+#endif
+}
+
+void CDPatternBitmap::finishLoading(CRGB *buffer1, CRGB *buffer2, size_t bufferSize) {
+#if SD_CARD_SUPPORT
+    if (m_buffer1 != NULL) {
+        return; // Already done
+    }
+    // Whatever wasn't loaded ahead of time is loaded now
+    while (m_isValid && !loadStep()) {
+        if (!m_loadPlanned) {
+            // Another bitmap still has the shared buffer
+            DEBUG_PRINTLN("shared buffer still in use");
+            m_isValid = false;
+        }
+    }
+    
+    if (m_isValid && !m_bufferIsFullCRGBData) {
         // Try to use the passed in buffers
         size_t requiredBufferSize = sizeof(CRGB)*getWidth();
         if (bufferSize >= requiredBufferSize) {
@@ -685,11 +831,14 @@ CDPatternBitmap::CDPatternBitmap(const char *filename, CRGB *buffer1, CRGB *buff
     if (m_isValid) {
         incYOffsetBuffers();
     }
-    #endif
+#endif
 }
 
 
 CDPatternBitmap::~CDPatternBitmap() {
+    if (g_sharedBufferOwner == this) {
+        g_sharedBufferOwner = NULL;
+    }
     if (m_buffer1Owned) {
         if (m_buffer1) {
             free(m_buffer1);
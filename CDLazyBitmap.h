@@ -92,9 +92,12 @@ private:
     void fillEntireBufferFromFile(CRGB *buffer);
 
     
-    void fillEntireBufferFromFile_comp0(CRGB *buffer);
+    void fillBufferRowsFromFile_comp0(CRGB *buffer, uint32_t startY, uint32_t endY);
     // compression level 1, RLE 8
-    void fillEntireBufferFromFile_comp1(CRGB *buffer);
+    bool fillBufferFromFile_comp1(CRGB *buffer, int maxRuns);
+    
+    void openAndReadHeaders(const char *filename);
+    bool planLoading();
     
     
 public:
@@ -122,11 +125,27 @@ private:
     uint32_t m_bufferOwned:1;
     uint32_t m_bufferIsEntireFile:1;
     uint32_t m_bufferIsFullCRGBData:1;
+    // incremental loading state
+    uint32_t m_loadStarted:1;
+    uint32_t m_loadPlanned:1;
+    uint32_t m_loadDone:1;
+    uint32_t m_loadPosition; // rows for full CRGB data, bytes when holding the entire file
+    int m_loadX, m_loadY; // where RLE decoding left off
 public:
     // buffers MAY be REFERENCED, if large enough -- they are not owned by this class, and the memory must be kept alive outside of it
     CDPatternBitmap(const char *filename, CRGB *buffer1, CRGB *buffer2, size_t bufferSize);
+    
+    // Only reads the headers and palette; call loadStep() to read the data in small pieces (ie: once a frame while another pattern plays), then finishLoading() before it is used.
+    CDPatternBitmap(const char *filename);
     ~CDPatternBitmap();
     
+    // Returns true when there is nothing left to load. Returns false if there is more, or it is waiting for another bitmap to release the shared buffer.
+    bool loadStep();
+    // Gets the buffer the data is loaded into, if it can; returns false while it has to wait for another bitmap to release the shared buffer (and there isn't enough RAM for one of its own)
+    bool prepareBuffer();
+    // Loads whatever is left and sets up the row buffers; same rules for the buffers as the constructor
+    void finishLoading(CRGB *buffer1, CRGB *buffer2, size_t bufferSize);
+    
     // Loads the next y offset, wrapping as needed
     inline void incYOffsetBuffers() {
         int oldOffset = m_yOffset;
@@ -177,6 +196,8 @@ public:
 #endif
         return m_buffer1;
     }
+    // True when one of the two rows is kept in buffer
+    inline bool hasRowsIn(const CRGB *buffer) { return buffer != NULL && (m_buffer1 == buffer || m_buffer2 == buffer); }
     inline CRGB *getSecondBuffer() {
 #if DEBUG
         ASSERT(m_buffer2 != NULL)
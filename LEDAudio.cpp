@@ -0,0 +1,280 @@
+//
+//  LEDAudio.cpp
+//  LEDDigitalCyrWheel
+//
+//
+
+#include "LEDAudio.h"
+
+uint32_t LEDAudioRingSource::readSamples(int16_t *samples, uint32_t maxCount) {
+    uint32_t head = m_head;
+    if (head - m_tail > LED_AUDIO_RING_SIZE) {
+        // We fell behind; skip to what is still in there
+        m_tail = head - LED_AUDIO_RING_SIZE;
+    }
+    uint32_t count = head - m_tail;
+    if (count > maxCount) {
+        // Only the newest matter
+        m_tail = head - maxCount;
+        count = maxCount;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        samples[i] = m_ring[m_tail & (LED_AUDIO_RING_SIZE - 1)];
+        m_tail++;
+    }
+    return count;
+}
+
+#ifdef PATTERN_EDITOR
+
+typedef struct __attribute__((__packed__)) {
+    uint16_t format; // 1 is PCM
+    uint16_t channels;
+    uint32_t sampleRate;
+    uint32_t byteRate;
+    uint16_t blockAlign;
+    uint16_t bitsPerSample;
+} LEDWAVFormatChunk;
+
+LEDAudioWAVSource::LEDAudioWAVSource(const char *path) : m_file(NULL), m_dataOffset(0), m_sampleCount(0), m_position(0), m_sampleRate(0), m_channels(1), m_lastTime(0) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return;
+    }
+    char riff[12];
+    if (fread(riff, 1, 12, file) != 12 || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        fclose(file);
+        return;
+    }
+    // Walk the chunks for the format and the data
+    bool hasFormat = false;
+    char chunkID[4];
+    uint32_t chunkSize;
+    while (fread(chunkID, 1, 4, file) == 4 && fread(&chunkSize, 4, 1, file) == 1) {
+        if (memcmp(chunkID, "fmt ", 4) == 0 && chunkSize >= sizeof(LEDWAVFormatChunk)) {
+            LEDWAVFormatChunk format;
+            if (fread(&format, sizeof(format), 1, file) != 1) {
+                break;
+            }
+            if (format.format != 1 || format.bitsPerSample != 16 || format.channels == 0) {
+                break; // only 16-bit PCM
+            }
+            m_channels = format.channels;
+            m_sampleRate = format.sampleRate;
+            hasFormat = true;
+            fseek(file, chunkSize - sizeof(format) + (chunkSize & 1), SEEK_CUR);
+        } else if (memcmp(chunkID, "data", 4) == 0) {
+            if (hasFormat) {
+                m_dataOffset = ftell(file);
+                m_sampleCount = chunkSize / (2 * m_channels);
+                m_file = file;
+                m_lastTime = millis();
+                return;
+            }
+            break;
+        } else {
+            fseek(file, chunkSize + (chunkSize & 1), SEEK_CUR);
+        }
+    }
+    fclose(file);
+}
+
+LEDAudioWAVSource::~LEDAudioWAVSource() {
+    if (m_file) {
+        fclose(m_file);
+    }
+}
+
+uint32_t LEDAudioWAVSource::readSamples(int16_t *samples, uint32_t maxCount) {
+    if (m_file == NULL || m_sampleCount == 0) {
+        return 0;
+    }
+    // As many as would have played since the last call
+    uint32_t now = millis();
+    uint32_t count = ((now - m_lastTime) * m_sampleRate) / 1000;
+    if (count == 0) {
+        return 0;
+    }
+    m_lastTime = now;
+    if (count > maxCount) {
+        // Skip ahead to the newest
+        m_position = (m_position + count - maxCount) % m_sampleCount;
+        count = maxCount;
+    }
+    fseek(m_file, m_dataOffset + m_position * 2 * m_channels, SEEK_SET);
+    for (uint32_t i = 0; i < count; i++) {
+        if (m_position == m_sampleCount) {
+            m_position = 0;
+            fseek(m_file, m_dataOffset, SEEK_SET);
+        }
+        // Mix the channels down to mono
+        int32_t sum = 0;
+        for (int c = 0; c < m_channels; c++) {
+            int16_t sample = 0;
+            fread(&sample, 2, 1, m_file);
+            sum += sample;
+        }
+        samples[i] = sum / m_channels;
+        m_position++;
+    }
+    return count;
+}
+
+#endif
+
+// Q15 tables, made the first time an analyzer is created
+static int16_t g_fftCos[LED_AUDIO_FFT_SIZE / 2];
+static int16_t g_fftSin[LED_AUDIO_FFT_SIZE / 2];
+static int16_t g_fftWindow[LED_AUDIO_FFT_SIZE]; // Hann
+static bool g_fftTablesMade = false;
+
+static void makeFFTTables() {
+    if (g_fftTablesMade) {
+        return;
+    }
+    for (int i = 0; i < LED_AUDIO_FFT_SIZE / 2; i++) {
+        uint16_t angle = (i * 65536UL) / LED_AUDIO_FFT_SIZE;
+        g_fftCos[i] = cos16(angle);
+        g_fftSin[i] = sin16(angle);
+    }
+    for (int i = 0; i < LED_AUDIO_FFT_SIZE; i++) {
+        uint16_t angle = (i * 65536UL) / LED_AUDIO_FFT_SIZE;
+        g_fftWindow[i] = (32767 - cos16(angle)) / 2;
+    }
+    g_fftTablesMade = true;
+}
+
+// In place radix-2 decimation in time FFT in Q15. Each stage halves the values so it can't overflow; the result is scaled down by the size.
+static void fixedPointFFT(int16_t *re, int16_t *im) {
+    const int n = LED_AUDIO_FFT_SIZE;
+    // bit reverse the order
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            int16_t tmp = re[i]; re[i] = re[j]; re[j] = tmp;
+            tmp = im[i]; im[i] = im[j]; im[j] = tmp;
+        }
+    }
+
+    for (int size = 2; size <= n; size <<= 1) {
+        int half = size >> 1;
+        int step = n / size; // through the twiddle tables
+        for (int start = 0; start < n; start += size) {
+            for (int k = 0; k < half; k++) {
+                // w = e^(-i*2*pi*k/size)
+                int32_t wr = g_fftCos[k * step];
+                int32_t wi = -g_fftSin[k * step];
+                int a = start + k;
+                int b = a + half;
+                int32_t tr = (wr * re[b] - wi * im[b]) >> 15;
+                int32_t ti = (wr * im[b] + wi * re[b]) >> 15;
+                int32_t ar = re[a];
+                int32_t ai = im[a];
+                re[a] = (ar + tr) >> 1;
+                im[a] = (ai + ti) >> 1;
+                re[b] = (ar - tr) >> 1;
+                im[b] = (ai - ti) >> 1;
+            }
+        }
+    }
+}
+
+// First bin of each band, and the end; roughly doubling so it is closer to how we hear. Bin 0 (DC) is skipped.
+static const uint8_t g_bandBins[LED_AUDIO_BAND_COUNT + 1] = { 1, 2, 3, 5, 8, 13, 21, 34, LED_AUDIO_FFT_SIZE / 2 };
+
+// Below this the gain doesn't go up any more, so silence stays dark
+#define AUDIO_NOISE_FLOOR 32
+#define BEAT_MIN_INTERVAL 150 // ms
+
+LEDAudioAnalyzer::LEDAudioAnalyzer(LEDAudioSource *source) : m_source(source), m_historyPosition(0), m_levelPeak(AUDIO_NOISE_FLOOR), m_level(0), m_bassAverage(0), m_lastBeatTime(0), m_beatLevel(0), m_beat(false), m_lastUpdateTime(0) {
+    makeFFTTables();
+    bzero(m_history, sizeof(m_history));
+    bzero(m_bands, sizeof(m_bands));
+    bzero(m_rawBands, sizeof(m_rawBands));
+    for (int b = 0; b < LED_AUDIO_BAND_COUNT; b++) {
+        m_bandPeaks[b] = AUDIO_NOISE_FLOOR;
+    }
+}
+
+void LEDAudioAnalyzer::update(uint32_t now) {
+    if (now == m_lastUpdateTime) {
+        return; // already done this frame
+    }
+    uint32_t elapsed = now - m_lastUpdateTime;
+    m_lastUpdateTime = now;
+    m_beat = false;
+
+    uint32_t count = 0;
+    if (m_source) {
+        // Read straight into the FFT buffer, then into the history
+        count = m_source->readSamples(m_real, LED_AUDIO_FFT_SIZE);
+        for (uint32_t i = 0; i < count; i++) {
+            m_history[m_historyPosition] = m_real[i];
+            m_historyPosition = (m_historyPosition + 1) & (LED_AUDIO_FFT_SIZE - 1);
+        }
+    }
+
+    if (count > 0) {
+        analyze();
+    }
+
+    // Fade the beat out over about half a second
+    uint32_t fade = elapsed / 2;
+    m_beatLevel = fade > m_beatLevel ? 0 : m_beatLevel - fade;
+    if (m_beat) {
+        m_beatLevel = 255;
+    }
+}
+
+static inline uint8_t autoGain(uint16_t value, uint16_t *peak, uint16_t minimumPeak) {
+    // The peak falls about 1/64th a frame, and jumps up to anything louder
+    uint16_t fallen = *peak - (*peak >> 6) - 1;
+    *peak = max(max(value, fallen), minimumPeak);
+    return ((uint32_t)value * 255) / *peak;
+}
+
+void LEDAudioAnalyzer::analyze() {
+    // Window the newest samples into the FFT buffer; the level comes from the same pass
+    uint32_t levelSum = 0;
+    for (int i = 0; i < LED_AUDIO_FFT_SIZE; i++) {
+        int16_t sample = m_history[(m_historyPosition + i) & (LED_AUDIO_FFT_SIZE - 1)];
+        levelSum += abs(sample);
+        m_real[i] = ((int32_t)sample * g_fftWindow[i]) >> 15;
+        m_imag[i] = 0;
+    }
+    m_level = autoGain(levelSum >> (LED_AUDIO_FFT_BITS + 4), &m_levelPeak, AUDIO_NOISE_FLOOR);
+
+    fixedPointFFT(m_real, m_imag);
+
+    uint16_t loudestPeak = 0;
+    for (int b = 0; b < LED_AUDIO_BAND_COUNT; b++) {
+        uint32_t sum = 0;
+        for (int bin = g_bandBins[b]; bin < g_bandBins[b + 1]; bin++) {
+            // |x| is about the max plus half the min; no square root
+            uint16_t re = abs(m_real[bin]);
+            uint16_t im = abs(m_imag[bin]);
+            sum += re > im ? re + (im >> 1) : im + (re >> 1);
+        }
+        m_rawBands[b] = min(sum, (uint32_t)0xFFFF);
+        loudestPeak = max(loudestPeak, max(m_bandPeaks[b], m_rawBands[b]));
+    }
+    // Each band has its own gain so the highs show up next to the bass, but only up to 8x less than the loudest, or leakage from it would light up the quiet ones
+    uint16_t minimumPeak = max((uint16_t)(loudestPeak >> 3), (uint16_t)AUDIO_NOISE_FLOOR);
+    for (int b = 0; b < LED_AUDIO_BAND_COUNT; b++) {
+        m_bands[b] = autoGain(m_rawBands[b], &m_bandPeaks[b], minimumPeak);
+    }
+
+    // A beat is bass that jumps well over its recent average
+    uint32_t bass = ((uint32_t)m_rawBands[0] + m_rawBands[1]) << 8;
+    bool isLoudEnough = bass > (AUDIO_NOISE_FLOOR << 8);
+    if (isLoudEnough && bass > m_bassAverage + (m_bassAverage >> 1) && m_lastUpdateTime - m_lastBeatTime > BEAT_MIN_INTERVAL) {
+        m_beat = true;
+        m_lastBeatTime = m_lastUpdateTime;
+    }
+    // average over about 16 frames
+    m_bassAverage = m_bassAverage - (m_bassAverage >> 4) + (bass >> 4);
+}
@@ -0,0 +1,111 @@
+//
+//  LEDAudio.h
+//  LEDDigitalCyrWheel
+//
+//
+
+#ifndef __LEDDigitalCyrWheel__LEDAudio__
+#define __LEDDigitalCyrWheel__LEDAudio__
+
+#include "Arduino.h"
+#include "FastLED.h"
+
+#ifdef PATTERN_EDITOR
+#include <stdio.h>
+#endif
+
+// 128 samples at ~8kHz gives 64 bins of 62.5Hz, and is about 16ms of sound; good enough for lights
+#define LED_AUDIO_FFT_BITS 7
+#define LED_AUDIO_FFT_SIZE (1 << LED_AUDIO_FFT_BITS)
+#define LED_AUDIO_BAND_COUNT 8
+
+// Where the samples come from. Samples are signed 16-bit mono, centered on 0.
+class LEDAudioSource {
+public:
+    virtual ~LEDAudioSource() { }
+    // Copies up to maxCount of the samples that arrived since the last call, oldest first; returns how many were copied
+    virtual uint32_t readSamples(int16_t *samples, uint32_t maxCount) = 0;
+};
+
+// For the device: call addSample from the ADC interrupt (or a timer that does analogRead), and the patterns read from it. If it isn't read fast enough the oldest samples are dropped.
+#define LED_AUDIO_RING_SIZE 512 // power of 2
+class LEDAudioRingSource : public LEDAudioSource {
+private:
+    volatile int16_t m_ring[LED_AUDIO_RING_SIZE];
+    volatile uint32_t m_head; // only written by addSample
+    uint32_t m_tail;
+public:
+    LEDAudioRingSource() : m_head(0), m_tail(0) { }
+
+    inline void addSample(int16_t sample) {
+        m_ring[m_head & (LED_AUDIO_RING_SIZE - 1)] = sample;
+        m_head++;
+    }
+    // For raw readings; ie: addSample(LEDAudioRingSource::SampleFromADC(analogRead(A0), 10))
+    static inline int16_t SampleFromADC(uint16_t reading, uint8_t bits) {
+        return (int16_t)((int32_t)(reading << (16 - bits)) - 32768);
+    }
+
+    virtual uint32_t readSamples(int16_t *samples, uint32_t maxCount);
+};
+
+#ifdef PATTERN_EDITOR
+// Stand in for the microphone in the pattern editor: plays a 16-bit PCM WAV file in real time, looping
+class LEDAudioWAVSource : public LEDAudioSource {
+private:
+    FILE *m_file;
+    uint32_t m_dataOffset;
+    uint32_t m_sampleCount; // per channel
+    uint32_t m_position;
+    uint32_t m_sampleRate;
+    uint16_t m_channels;
+    uint32_t m_lastTime;
+public:
+    LEDAudioWAVSource(const char *path);
+    virtual ~LEDAudioWAVSource();
+    inline bool isValid() { return m_file != NULL; }
+    virtual uint32_t readSamples(int16_t *samples, uint32_t maxCount);
+};
+#endif
+
+// Analysis done once a frame and shared by all the audio patterns: band energies from a fixed point FFT, the overall level and beats
+class LEDAudioAnalyzer {
+private:
+    LEDAudioSource *m_source;
+    int16_t m_history[LED_AUDIO_FFT_SIZE]; // the latest samples; a ring
+    uint32_t m_historyPosition;
+    int16_t m_real[LED_AUDIO_FFT_SIZE];
+    int16_t m_imag[LED_AUDIO_FFT_SIZE];
+
+    uint16_t m_rawBands[LED_AUDIO_BAND_COUNT];
+    uint16_t m_bandPeaks[LED_AUDIO_BAND_COUNT]; // for the automatic gain
+    uint8_t m_bands[LED_AUDIO_BAND_COUNT];
+    uint16_t m_levelPeak;
+    uint8_t m_level;
+
+    uint32_t m_bassAverage; // 24.8
+    uint32_t m_lastBeatTime;
+    uint8_t m_beatLevel;
+    bool m_beat;
+    uint32_t m_lastUpdateTime;
+
+    void analyze();
+public:
+    LEDAudioAnalyzer(LEDAudioSource *source);
+    inline void setSource(LEDAudioSource *source) { m_source = source; }
+    inline LEDAudioSource *getSource() { return m_source; }
+
+    // Reads what is new from the source and analyzes it; only does the work once for a given time, so every pattern can call it
+    void update(uint32_t now);
+
+    // 0..255 with automatic gain; band 0 is the lowest
+    inline uint8_t getBand(int band) { return m_bands[band]; }
+    inline const uint8_t *getBands() { return m_bands; }
+    inline uint8_t getLevel() { return m_level; }
+    // True on the frame a beat happened
+    inline bool isBeat() { return m_beat; }
+    // 255 on a beat, and fades off after it
+    inline uint8_t getBeatLevel() { return m_beatLevel; }
+};
+
+#endif /* defined(__LEDDigitalCyrWheel__LEDAudio__) */
@@ -0,0 +1,164 @@
+//
+//  LEDBlend.cpp
+//  LEDDigitalCyrWheel
+//
+//
+
+#include "LEDBlend.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Bytes 0 and 2, and 1 and 3, of a word in two 16-bit lanes
+static inline uint32_t evenBytes(uint32_t x) {
+#if defined(__ARM_FEATURE_SIMD32)
+    uint32_t result;
+    asm ("uxtb16 %0, %1" : "=r" (result) : "r" (x));
+    return result;
+#else
+    return x & 0x00FF00FF;
+#endif
+}
+
+static inline uint32_t oddBytes(uint32_t x) {
+#if defined(__ARM_FEATURE_SIMD32)
+    uint32_t result;
+    asm ("uxtb16 %0, %1, ror #8" : "=r" (result) : "r" (x));
+    return result;
+#else
+    return (x >> 8) & 0x00FF00FF;
+#endif
+}
+
+// Handles the ends, so they are exact; returns true if it did
+static inline bool blendEnds(CRGB *dest, const CRGB *from, const CRGB *to, uint32_t count, uint16_t amountOfTo) {
+    if (amountOfTo == 0) {
+        if (dest != from) {
+            memmove(dest, from, sizeof(CRGB) * count);
+        }
+        return true;
+    } else if (amountOfTo >= 256) {
+        if (dest != to) {
+            memmove(dest, to, sizeof(CRGB) * count);
+        }
+        return true;
+    }
+    return false;
+}
+
+void LEDBlend::Blend(CRGB *dest, const CRGB *from, const CRGB *to, uint32_t count, uint16_t amountOfTo) {
+    if (blendEnds(dest, from, to, count, amountOfTo)) {
+        return;
+    }
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *f = (const uint8_t *)from;
+    const uint8_t *t = (const uint8_t *)to;
+    const uint16_t amountOfFrom = 256 - amountOfTo;
+    const uint32_t byteCount = count * sizeof(CRGB);
+    uint32_t i = 0;
+    // (f * amountOfFrom + t * amountOfTo) is at most 255 * 256, so each byte fits in a 16-bit lane
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i fromScale = _mm_set1_epi16(amountOfFrom);
+    const __m128i toScale = _mm_set1_epi16(amountOfTo);
+    for (; i + 16 <= byteCount; i += 16) {
+        __m128i fv = _mm_loadu_si128((const __m128i *)&f[i]);
+        __m128i tv = _mm_loadu_si128((const __m128i *)&t[i]);
+        __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(fv, zero), fromScale), _mm_mullo_epi16(_mm_unpacklo_epi8(tv, zero), toScale));
+        __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(fv, zero), fromScale), _mm_mullo_epi16(_mm_unpackhi_epi8(tv, zero), toScale));
+        _mm_storeu_si128((__m128i *)&d[i], _mm_packus_epi16(_mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= byteCount; i += 16) {
+        uint8x16_t fv = vld1q_u8(&f[i]);
+        uint8x16_t tv = vld1q_u8(&t[i]);
+        uint16x8_t low = vmulq_n_u16(vmovl_u8(vget_low_u8(fv)), amountOfFrom);
+        low = vmlaq_n_u16(low, vmovl_u8(vget_low_u8(tv)), amountOfTo);
+        uint16x8_t high = vmulq_n_u16(vmovl_u8(vget_high_u8(fv)), amountOfFrom);
+        high = vmlaq_n_u16(high, vmovl_u8(vget_high_u8(tv)), amountOfTo);
+        vst1q_u8(&d[i], vcombine_u8(vshrn_n_u16(low, 8), vshrn_n_u16(high, 8)));
+    }
+#endif
+    // 4 bytes at a time, two in each multiply
+    for (; i + 4 <= byteCount; i += 4) {
+        uint32_t fv, tv;
+        memcpy(&fv, &f[i], 4); // may not be aligned
+        memcpy(&tv, &t[i], 4);
+        uint32_t even = (evenBytes(fv) * amountOfFrom + evenBytes(tv) * amountOfTo) >> 8;
+        uint32_t odd = oddBytes(fv) * amountOfFrom + oddBytes(tv) * amountOfTo;
+        uint32_t result = (even & 0x00FF00FF) | (odd & 0xFF00FF00);
+        memcpy(&d[i], &result, 4);
+    }
+    for (; i < byteCount; i++) {
+        d[i] = (f[i] * amountOfFrom + t[i] * amountOfTo) >> 8;
+    }
+}
+
+// sRGB to linear light in 16 bits. It is linear at the bottom, so every byte decodes to a different value, and going back to bytes is exact.
+static uint16_t *g_linearDecode; // 256
+// linear >> 6 to the nearest byte for the start of that range; encodeLinear finishes it off
+#define LINEAR_ENCODE_SHIFT 6
+static uint8_t *g_linearEncode; // 1024
+
+static bool makeLinearTables() {
+    if (g_linearEncode) {
+        return true;
+    }
+    uint16_t *decode = (uint16_t *)malloc(sizeof(uint16_t) * 256);
+    uint8_t *encode = (uint8_t *)malloc(65536 >> LINEAR_ENCODE_SHIFT);
+    if (decode == NULL || encode == NULL) {
+        free(decode);
+        free(encode);
+        return false;
+    }
+    for (int i = 0; i < 256; i++) {
+        float x = i / 255.0;
+        float linear = x <= 0.04045 ? x / 12.92 : pow((x + 0.055) / 1.055, 2.4);
+        decode[i] = round(linear * 65535.0);
+    }
+    int e = 0;
+    for (uint32_t k = 0; k < (65536 >> LINEAR_ENCODE_SHIFT); k++) {
+        uint32_t linear = k << LINEAR_ENCODE_SHIFT;
+        while (e < 255 && linear * 2 >= (uint32_t)decode[e] + decode[e + 1]) {
+            e++;
+        }
+        encode[k] = e;
+    }
+    g_linearDecode = decode;
+    g_linearEncode = encode;
+    return true;
+}
+
+static inline uint8_t encodeLinear(uint32_t linear) {
+    uint32_t e = g_linearEncode[linear >> LINEAR_ENCODE_SHIFT];
+    // Only a few steps at the dark end, where the bytes are closest together
+    while (e < 255 && linear * 2 >= (uint32_t)g_linearDecode[e] + g_linearDecode[e + 1]) {
+        e++;
+    }
+    return e;
+}
+
+void LEDBlend::BlendLinear(CRGB *dest, const CRGB *from, const CRGB *to, uint32_t count, uint16_t amountOfTo) {
+    if (blendEnds(dest, from, to, count, amountOfTo)) {
+        return;
+    }
+    if (!makeLinearTables()) {
+        Blend(dest, from, to, count, amountOfTo);
+        return;
+    }
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *f = (const uint8_t *)from;
+    const uint8_t *t = (const uint8_t *)to;
+    const uint32_t amountOfFrom = 256 - amountOfTo;
+    const uint32_t byteCount = count * sizeof(CRGB);
+    for (uint32_t i = 0; i < byteCount; i++) {
+        if (f[i] == t[i]) {
+            d[i] = f[i]; // common, as most crossfades have a lot the same (or black)
+        } else {
+            d[i] = encodeLinear((g_linearDecode[f[i]] * amountOfFrom + g_linearDecode[t[i]] * amountOfTo) >> 8);
+        }
+    }
+}
@@ -0,0 +1,23 @@
+//
+//  LEDBlend.h
+//  LEDDigitalCyrWheel
+//
+//
+
+#ifndef __LEDDigitalCyrWheel__LEDBlend__
+#define __LEDDigitalCyrWheel__LEDBlend__
+
+#include "Arduino.h"
+#include "FastLED.h"
+
+// Blending two whole buffers, for the crossfade that runs between every pattern. It works on the raw channel bytes, as many at a time as the CPU can: 16 with SSE2 or NEON (the pattern editor), and 4 in 32-bit words otherwise (the Teensy, where the DSP instructions help split them up).
+class LEDBlend {
+public:
+    // amountOfTo is 0 (all from) to 256 (all to). dest can be the same as from or to.
+    static void Blend(CRGB *dest, const CRGB *from, const CRGB *to, uint32_t count, uint16_t amountOfTo);
+
+    // The same, but the light is blended instead of the gamma encoded bytes, so halfway between two colors isn't darker than both of them. It goes through sRGB decode/encode tables (1.5k, made the first time); falls back to Blend if there isn't enough RAM.
+    static void BlendLinear(CRGB *dest, const CRGB *from, const CRGB *to, uint32_t count, uint16_t amountOfTo);
+};
+
+#endif /* defined(__LEDDigitalCyrWheel__LEDBlend__) */
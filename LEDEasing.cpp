@@ -0,0 +1,70 @@
+//
+//  LEDEasing.cpp
+//  LEDDigitalCyrWheel
+//
+//
+
+#include "LEDEasing.h"
+
+static uint8_t *g_easingTables[LEDEasingTypeCount];
+
+static float easeValue(LEDEasingType type, float x) {
+    switch (type) {
+        case LEDEasingTypeQuadratic:
+            return x * x;
+        case LEDEasingTypeCubic:
+            return x * x * x;
+        case LEDEasingTypeSine:
+            return (1.0 - cos(M_PI * x)) / 2.0;
+        case LEDEasingTypeExponential:
+            return x == 0 ? 0 : pow(2.0, 10.0 * (x - 1.0));
+        case LEDEasingTypeGamma:
+            return pow(x, 2.2);
+        case LEDEasingTypeDefault:
+        case LEDEasingTypeLinear:
+        default:
+            return x;
+    }
+}
+
+const uint8_t *LEDEasing::GetTable(LEDEasingType type) {
+    if (type >= LEDEasingTypeCount) {
+        type = LEDEasingTypeLinear;
+    }
+    if (g_easingTables[type] == NULL) {
+        uint8_t *table = (uint8_t *)malloc(256);
+        if (table == NULL) {
+            return NULL;
+        }
+        for (int i = 0; i < 256; i++) {
+            table[i] = round(easeValue(type, i / 255.0) * 255.0);
+        }
+        g_easingTables[type] = table;
+    }
+    return g_easingTables[type];
+}
+
+uint8_t LEDEasing::Ease(LEDEasingType type, uint8_t x) {
+    const uint8_t *table = GetTable(type);
+    return table ? table[x] : x;
+}
+
+void LEDEasing::ScaleLEDs(CRGB *result, const CRGB *source, uint32_t count, uint8_t scale) {
+    // (x * (scale + 1)) >> 8 leaves x alone at 255, and each byte still fits in 16 bits
+    uint32_t s = scale + 1;
+    const uint8_t *from = (const uint8_t *)source;
+    uint8_t *to = (uint8_t *)result;
+    uint32_t byteCount = count * sizeof(CRGB);
+    uint32_t i = 0;
+    for (; i + 4 <= byteCount; i += 4) {
+        uint32_t x;
+        memcpy(&x, &from[i], 4);
+        uint32_t evens = (((x & 0x00FF00FF) * s) >> 8) & 0x00FF00FF;
+        uint32_t odds = (((x >> 8) & 0x00FF00FF) * s) & 0xFF00FF00;
+        x = evens | odds;
+        memcpy(&to[i], &x, 4);
+    }
+    for (; i < byteCount; i++) {
+        to[i] = (from[i] * s) >> 8;
+    }
+}
@@ -0,0 +1,26 @@
+//
+//  LEDEasing.h
+//  LEDDigitalCyrWheel
+//
+//
+
+#ifndef __LEDDigitalCyrWheel__LEDEasing__
+#define __LEDDigitalCyrWheel__LEDEasing__
+
+#include "Arduino.h"
+#include "FastLED.h"
+#include "LEDPatternType.h"
+
+// The easing curves as 256 entry tables, so a fade looks up its level once a frame instead of doing float math for every LED. A table is made the first time its curve is asked for, and shared after that.
+class LEDEasing {
+public:
+    // y for each x, both 0..255. LEDEasingTypeDefault is linear. NULL if there isn't enough RAM.
+    static const uint8_t *GetTable(LEDEasingType type);
+    // Falls back to linear if the table can't be made
+    static uint8_t Ease(LEDEasingType type, uint8_t x);
+
+    // result = source scaled by scale (255 is all of it), for count LEDs; they can be the same buffer. Does two bytes in each 32-bit multiply.
+    static void ScaleLEDs(CRGB *result, const CRGB *source, uint32_t count, uint8_t scale);
+};
+
+#endif /* defined(__LEDDigitalCyrWheel__LEDEasing__) */
@@ -0,0 +1,57 @@
+//
+//  LEDGeometry.cpp
+//  LEDDigitalCyrWheel
+//
+//
+
+#include "LEDGeometry.h"
+
+LEDGeometry::~LEDGeometry() {
+    clear();
+}
+
+void LEDGeometry::clear() {
+    if (m_angles) {
+        free(m_angles);
+        m_angles = NULL;
+    }
+    if (m_radii) {
+        free(m_radii);
+        m_radii = NULL;
+    }
+    m_ledCount = 0;
+}
+
+bool LEDGeometry::allocate(uint32_t ledCount) {
+    clear();
+    m_angles = (uint16_t *)malloc(sizeof(uint16_t) * ledCount);
+    m_radii = (uint8_t *)malloc(sizeof(uint8_t) * ledCount);
+    if (m_angles == NULL || m_radii == NULL) {
+        clear();
+        return false;
+    }
+    m_ledCount = ledCount;
+    setRing(0, ledCount, 0, 255);
+    return true;
+}
+
+void LEDGeometry::setRing(uint32_t firstLED, uint32_t count, uint16_t startAngle, uint8_t radius, bool reversed) {
+    if (firstLED + count > m_ledCount) {
+        count = firstLED < m_ledCount ? m_ledCount - firstLED : 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t angle = (uint16_t)((i * 65536UL) / count);
+        m_angles[firstLED + i] = reversed ? startAngle - angle : startAngle + angle;
+        m_radii[firstLED + i] = radius;
+    }
+}
+
+void LEDGeometry::setRingAngles(uint32_t firstLED, uint32_t count, const uint16_t *angles, uint8_t radius) {
+    if (firstLED + count > m_ledCount) {
+        count = firstLED < m_ledCount ? m_ledCount - firstLED : 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        m_angles[firstLED + i] = angles[i];
+        m_radii[firstLED + i] = radius;
+    }
+}
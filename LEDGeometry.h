@@ -0,0 +1,48 @@
+//
+//  LEDGeometry.h
+//  LEDDigitalCyrWheel
+//
+//
+
+#ifndef __LEDDigitalCyrWheel__LEDGeometry__
+#define __LEDDigitalCyrWheel__LEDGeometry__
+
+#include "Arduino.h"
+
+// Angles are fixed point: 65536 is a full circle, so they wrap on their own when added or subtracted as a uint16_t
+#define LED_ANGLE_FROM_DEGREES(d) ((uint16_t)(((uint32_t)(d) * 65536UL) / 360))
+
+// Where each LED is on a circle, for circular installs like the cyr wheel. Each LED has an angle and a radius (0..255, 255 being the outer ring), made once, so angle based patterns don't have to figure it out from the LED count every frame.
+// By default all the LEDs are one evenly spaced ring starting at angle 0 (the top) at LED 0.
+class LEDGeometry {
+private:
+    uint32_t m_ledCount;
+    uint16_t *m_angles;
+    uint8_t *m_radii;
+public:
+    LEDGeometry() : m_ledCount(0), m_angles(NULL), m_radii(NULL) { }
+    ~LEDGeometry();
+
+    // Allocates the tables (3 bytes per LED) with the default ring. Returns false if there isn't enough RAM.
+    bool allocate(uint32_t ledCount);
+    void clear();
+    inline bool isValid() { return m_angles != NULL; }
+
+    // Evenly spaces count LEDs starting at firstLED around a ring; startAngle is where the first one is, which is how a wheel that doesn't start at the top is handled. Reversed goes counter clockwise.
+    void setRing(uint32_t firstLED, uint32_t count, uint16_t startAngle, uint8_t radius, bool reversed = false);
+    // For LEDs that aren't evenly spaced; angles has count entries
+    void setRingAngles(uint32_t firstLED, uint32_t count, const uint16_t *angles, uint8_t radius);
+    inline void setLEDPosition(uint32_t led, uint16_t angle, uint8_t radius) {
+        if (led < m_ledCount) {
+            m_angles[led] = angle;
+            m_radii[led] = radius;
+        }
+    }
+
+    inline uint16_t getAngle(uint32_t led) { return m_angles[led]; }
+    inline uint8_t getRadius(uint32_t led) { return m_radii[led]; }
+    inline const uint16_t *getAngles() { return m_angles; }
+    inline const uint8_t *getRadii() { return m_radii; }
+};
+
+#endif /* defined(__LEDDigitalCyrWheel__LEDGeometry__) */
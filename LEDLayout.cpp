@@ -0,0 +1,78 @@
+//
+//  LEDLayout.cpp
+//  LEDDigitalCyrWheel
+//
+//
+
+#include "LEDLayout.h"
+
+LEDLayout::~LEDLayout() {
+    clear();
+}
+
+void LEDLayout::clear() {
+    if (m_map) {
+        free(m_map);
+        m_map = NULL;
+    }
+    m_width = 0;
+    m_height = 0;
+}
+
+bool LEDLayout::allocateMap(uint16_t width, uint16_t height) {
+    clear();
+    if (width == 0 || height == 0) {
+        return false;
+    }
+    m_map = (uint16_t *)malloc(sizeof(uint16_t) * width * height);
+    if (m_map == NULL) {
+        return false;
+    }
+    m_width = width;
+    m_height = height;
+    return true;
+}
+
+bool LEDLayout::setLayout(LEDLayoutType type, uint16_t width, uint16_t height) {
+    if (!allocateMap(width, height)) {
+        return false;
+    }
+    uint16_t *map = m_map;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            switch (type) {
+                case LEDLayoutTypeRowMajor:
+                    *map = y*width + x;
+                    break;
+                case LEDLayoutTypeSerpentine:
+                    *map = y*width + ((y & 1) ? width - 1 - x : x);
+                    break;
+                case LEDLayoutTypeColumnMajor:
+                    *map = x*height + y;
+                    break;
+                case LEDLayoutTypeColumnSerpentine:
+                    *map = x*height + ((x & 1) ? height - 1 - y : y);
+                    break;
+            }
+            map++;
+        }
+    }
+    return true;
+}
+
+bool LEDLayout::setCustomLayout(const uint8_t *xyTable, uint32_t ledCount, uint16_t width, uint16_t height, uint16_t holeIndex) {
+    if (!allocateMap(width, height)) {
+        return false;
+    }
+    for (int i = 0; i < width*height; i++) {
+        m_map[i] = holeIndex;
+    }
+    for (uint32_t i = 0; i < ledCount; i++) {
+        uint8_t x = xyTable[2*i];
+        uint8_t y = xyTable[2*i + 1];
+        if (x < width && y < height) {
+            m_map[y*width + x] = i;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+//
+//  LEDLayout.h
+//  LEDDigitalCyrWheel
+//
+//
+
+#ifndef __LEDDigitalCyrWheel__LEDLayout__
+#define __LEDDigitalCyrWheel__LEDLayout__
+
+#include "Arduino.h"
+
+// How a 2D panel is wired; x goes across and y goes down, and the strip starts at 0,0
+typedef enum {
+    LEDLayoutTypeRowMajor, // every row starts on the left
+    LEDLayoutTypeSerpentine, // rows go back and forth
+    LEDLayoutTypeColumnMajor, // every column starts at the top
+    LEDLayoutTypeColumnSerpentine, // columns go up and down (what XY() used to assume)
+} LEDLayoutType;
+
+// Maps x,y to the LED index with a table made once, instead of figuring out the wiring every call
+class LEDLayout {
+private:
+    uint16_t m_width;
+    uint16_t m_height;
+    uint16_t *m_map; // width*height, row by row
+
+    bool allocateMap(uint16_t width, uint16_t height);
+public:
+    LEDLayout() : m_width(0), m_height(0), m_map(NULL) { }
+    ~LEDLayout();
+
+    // Returns false if there isn't enough RAM
+    bool setLayout(LEDLayoutType type, uint16_t width, uint16_t height);
+    // For anything else, give the x,y of each LED as 2 bytes per LED (x then y). Cells that don't have an LED map to holeIndex, which should be a pixel that isn't shown.
+    bool setCustomLayout(const uint8_t *xyTable, uint32_t ledCount, uint16_t width, uint16_t height, uint16_t holeIndex);
+    void clear();
+
+    inline bool isValid() { return m_map != NULL; }
+    inline uint16_t getWidth() { return m_width; }
+    inline uint16_t getHeight() { return m_height; }
+
+    // x and y MUST be in range
+    inline uint16_t xy(int x, int y) {
+        return m_map[y*m_width + x];
+    }
+
+    // For when the coordinates may go off the edge; they stick to it
+    inline uint16_t xyClamped(int x, int y) {
+        x = constrain(x, 0, m_width - 1);
+        y = constrain(y, 0, m_height - 1);
+        return m_map[y*m_width + x];
+    }
+};
+
+#endif /* defined(__LEDDigitalCyrWheel__LEDLayout__) */
@@ -0,0 +1,84 @@
+//
+//  LEDPaletteCache.cpp
+//  LEDDigitalCyrWheel
+//
+//
+
+#include "LEDPaletteCache.h"
+
+LEDPaletteCache::LEDPaletteCache() : m_lastUsed(0) {
+    for (int i = 0; i < 2; i++) {
+        m_slots[i].colors = NULL;
+        m_slots[i].key = 0;
+        m_slots[i].isPalette = false;
+    }
+}
+
+LEDPaletteCache::~LEDPaletteCache() {
+    clear();
+}
+
+void LEDPaletteCache::clear() {
+    for (int i = 0; i < 2; i++) {
+        if (m_slots[i].colors) {
+            free(m_slots[i].colors);
+            m_slots[i].colors = NULL;
+        }
+    }
+}
+
+LEDPaletteCacheSlot *LEDPaletteCache::slotToReplace() {
+    // With two, the least recently used is the other one
+    int i = 1 - m_lastUsed;
+    LEDPaletteCacheSlot *slot = &m_slots[i];
+    if (slot->colors == NULL) {
+        slot->colors = (CRGB *)malloc(sizeof(CRGB) * 256);
+        if (slot->colors == NULL) {
+            // Not enough RAM for another; reuse the one there is
+            slot = &m_slots[m_lastUsed];
+            if (slot->colors == NULL) {
+                return NULL;
+            }
+            i = m_lastUsed;
+        }
+    }
+    m_lastUsed = i;
+    return slot;
+}
+
+const CRGB *LEDPaletteCache::getColors(const CRGBPalette16 &palette) {
+    for (int i = 0; i < 2; i++) {
+        if (m_slots[i].colors && m_slots[i].isPalette && m_slots[i].palette == palette) {
+            m_lastUsed = i;
+            return m_slots[i].colors;
+        }
+    }
+    LEDPaletteCacheSlot *slot = slotToReplace();
+    if (slot == NULL) {
+        return NULL;
+    }
+    slot->palette = palette;
+    slot->isPalette = true;
+    for (int i = 0; i < 256; i++) {
+        slot->colors[i] = ColorFromPalette(palette, i);
+    }
+    return slot->colors;
+}
+
+CRGB *LEDPaletteCache::getColorsForKey(uint32_t key, bool *isFilled) {
+    for (int i = 0; i < 2; i++) {
+        if (m_slots[i].colors && !m_slots[i].isPalette && m_slots[i].key == key) {
+            m_lastUsed = i;
+            *isFilled = true;
+            return m_slots[i].colors;
+        }
+    }
+    *isFilled = false;
+    LEDPaletteCacheSlot *slot = slotToReplace();
+    if (slot == NULL) {
+        return NULL;
+    }
+    slot->key = key;
+    slot->isPalette = false;
+    return slot->colors;
+}
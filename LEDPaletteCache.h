@@ -0,0 +1,40 @@
+//
+//  LEDPaletteCache.h
+//  LEDDigitalCyrWheel
+//
+//
+
+#ifndef __LEDDigitalCyrWheel__LEDPaletteCache__
+#define __LEDDigitalCyrWheel__LEDPaletteCache__
+
+#include "Arduino.h"
+#include "FastLED.h"
+
+// ColorFromPalette blends between two of the 16 entries on every call, which at a few hundred LEDs costs more than the pattern itself. This expands a palette into all 256 colors once, and hands back the same table until a different palette is asked for.
+// It holds two tables, and replaces the one that was used longest ago, so both sides of a transition (ie: fire crossfading to a sine wave) stay cached. A third palette at the same time rebuilds a table each time it is asked for.
+typedef struct {
+    CRGB *colors; // 256; NULL until it is used
+    CRGBPalette16 palette;
+    uint32_t key;
+    bool isPalette; // else key says what is in it
+} LEDPaletteCacheSlot;
+
+class LEDPaletteCache {
+private:
+    LEDPaletteCacheSlot m_slots[2];
+    uint8_t m_lastUsed; // the slot most recently handed back
+    // The slot to put a new table in; NULL if there isn't enough RAM
+    LEDPaletteCacheSlot *slotToReplace();
+public:
+    LEDPaletteCache();
+    ~LEDPaletteCache();
+    void clear();
+
+    // The 256 colors for the palette, same as ColorFromPalette(palette, index) with LINEARBLEND. NULL if there isn't enough RAM (768 bytes a table).
+    const CRGB *getColors(const CRGBPalette16 &palette);
+
+    // For a table that doesn't come from a palette; ie: all the colors one pattern can make in a run. The caller picks a key that says what goes in it, and *isFilled is true when it already has the colors for that key; otherwise fill in all 256. NULL if there isn't enough RAM.
+    CRGB *getColorsForKey(uint32_t key, bool *isFilled);
+};
+
+#endif /* defined(__LEDDigitalCyrWheel__LEDPaletteCache__) */
@@ -0,0 +1,163 @@
+//
+//  LEDParticles.cpp
+//  LEDDigitalCyrWheel
+//
+//
+
+#include "LEDParticles.h"
+
+#if 1 // DEBUG
+    #define DEBUG_PRINTLN(a) Serial.println(a)
+#else
+    #define DEBUG_PRINTLN(a)
+#endif
+
+// Snapshot data starts with this, followed by the block
+typedef struct {
+    uint16_t count;
+    uint16_t reserved;
+    uint32_t lastUpdateTime;
+} LEDParticlesSnapshotHeader;
+
+LEDParticles::~LEDParticles() {
+    clear();
+}
+
+uint32_t LEDParticles::BlockSize(uint16_t capacity) {
+    // The 4 byte values first so they stay aligned
+    return (uint32_t)capacity * (3*sizeof(int32_t) + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(CRGB));
+}
+
+void LEDParticles::setArrays() {
+    m_positions = (int32_t *)m_block;
+    m_velocities = m_positions + m_capacity;
+    m_accelerations = m_velocities + m_capacity;
+    m_times = (uint32_t *)(m_accelerations + m_capacity);
+    m_restitutions = (uint16_t *)(m_times + m_capacity);
+    m_colors = (CRGB *)(m_restitutions + m_capacity);
+}
+
+void LEDParticles::clear() {
+    if (m_block) {
+        free(m_block);
+        m_block = NULL;
+    }
+    m_capacity = 0;
+    m_count = 0;
+    setArrays();
+}
+
+bool LEDParticles::allocate(uint16_t capacity) {
+    if (m_block && capacity <= m_capacity) {
+        m_count = 0;
+        return true;
+    }
+    clear();
+    if (capacity == 0) {
+        return false;
+    }
+    m_block = (uint8_t *)malloc(BlockSize(capacity));
+    if (m_block == NULL) {
+        DEBUG_PRINTLN("not enough RAM for the particles");
+        return false;
+    }
+    m_capacity = capacity;
+    setArrays();
+    return true;
+}
+
+int LEDParticles::add(int32_t position, int32_t velocity, int32_t acceleration, CRGB color) {
+    if (m_count >= m_capacity) {
+        return -1;
+    }
+    int i = m_count;
+    m_positions[i] = position;
+    m_velocities[i] = velocity;
+    m_accelerations[i] = acceleration;
+    m_times[i] = m_lastUpdateTime;
+    m_restitutions[i] = 65535;
+    m_colors[i] = color;
+    m_count++;
+    return i;
+}
+
+void LEDParticles::update(uint32_t now, uint32_t wrapLength) {
+    uint32_t elapsed = now - m_lastUpdateTime;
+    m_lastUpdateTime = now;
+    if (elapsed == 0) {
+        return;
+    }
+    // The one division for the frame; the seconds passed in 16.16
+    int64_t seconds = ((int64_t)elapsed << 16) / 1000;
+    int32_t wrap = LED_PARTICLE_FROM_INT(wrapLength);
+    for (int i = 0; i < m_count; i++) {
+        int32_t velocity = m_velocities[i] + (int32_t)((m_accelerations[i] * seconds) >> 16);
+        m_velocities[i] = velocity;
+        int32_t position = m_positions[i] + (int32_t)((velocity * seconds) >> 16);
+        if (wrap > 0) {
+            if (position >= wrap) {
+                position -= wrap;
+            } else if (position < 0) {
+                position += wrap;
+            }
+            if (position < 0 || position >= wrap) {
+                // Went more than all the way around
+                position %= wrap;
+                if (position < 0) {
+                    position += wrap;
+                }
+            }
+        }
+        m_positions[i] = position;
+    }
+}
+
+uint32_t LEDParticles::SnapshotSize(uint16_t count) {
+    return sizeof(LEDParticlesSnapshotHeader) + BlockSize(count);
+}
+
+void LEDParticles::snapshot(void *data) {
+    LEDParticlesSnapshotHeader *header = (LEDParticlesSnapshotHeader *)data;
+    header->count = m_count;
+    header->reserved = 0;
+    header->lastUpdateTime = m_lastUpdateTime;
+    // The arrays are laid out by capacity in the block, but by count in a snapshot
+    uint8_t *dest = (uint8_t *)data + sizeof(LEDParticlesSnapshotHeader);
+    memcpy(dest, m_positions, m_count*sizeof(int32_t)); dest += m_count*sizeof(int32_t);
+    memcpy(dest, m_velocities, m_count*sizeof(int32_t)); dest += m_count*sizeof(int32_t);
+    memcpy(dest, m_accelerations, m_count*sizeof(int32_t)); dest += m_count*sizeof(int32_t);
+    memcpy(dest, m_times, m_count*sizeof(uint32_t)); dest += m_count*sizeof(uint32_t);
+    memcpy(dest, m_restitutions, m_count*sizeof(uint16_t)); dest += m_count*sizeof(uint16_t);
+    memcpy(dest, m_colors, m_count*sizeof(CRGB));
+}
+
+bool LEDParticles::restore(const void *data, uint32_t size) {
+    const LEDParticlesSnapshotHeader *header = (const LEDParticlesSnapshotHeader *)data;
+    if (size < sizeof(LEDParticlesSnapshotHeader) || size < SnapshotSize(header->count)) {
+        return false;
+    }
+    uint16_t count = header->count;
+    if (count > 0) {
+        // Keeps the block when it is big enough, which it is once it has been sized for every pattern
+        if (!allocate(count)) {
+            return false;
+        }
+        const uint8_t *src = (const uint8_t *)data + sizeof(LEDParticlesSnapshotHeader);
+        memcpy(m_positions, src, count*sizeof(int32_t)); src += count*sizeof(int32_t);
+        memcpy(m_velocities, src, count*sizeof(int32_t)); src += count*sizeof(int32_t);
+        memcpy(m_accelerations, src, count*sizeof(int32_t)); src += count*sizeof(int32_t);
+        memcpy(m_times, src, count*sizeof(uint32_t)); src += count*sizeof(uint32_t);
+        memcpy(m_restitutions, src, count*sizeof(uint16_t)); src += count*sizeof(uint16_t);
+        memcpy(m_colors, src, count*sizeof(CRGB));
+    }
+    m_count = count;
+    m_lastUpdateTime = header->lastUpdateTime;
+    return true;
+}
+
+void LEDParticles::rebaseTime(uint32_t elapsed) {
+    m_lastUpdateTime += elapsed;
+    for (int i = 0; i < m_count; i++) {
+        m_times[i] += elapsed;
+    }
+}
@@ -0,0 +1,75 @@
+//
+//  LEDParticles.h
+//  LEDDigitalCyrWheel
+//
+//
+
+#ifndef __LEDDigitalCyrWheel__LEDParticles__
+#define __LEDDigitalCyrWheel__LEDParticles__
+
+#include "Arduino.h"
+#include "FastLED.h"
+
+// Fixed point with 16 bits of fraction; positions are in LEDs, velocities in LEDs a second, and accelerations in LEDs a second a second
+#define LED_PARTICLE_ONE 65536
+#define LED_PARTICLE_FROM_INT(a) ((int32_t)(a) * LED_PARTICLE_ONE)
+#define LED_PARTICLE_TO_INT(a) ((a) >> 16)
+
+// A fixed size pool of particles for the patterns that move things along the strip (life, bouncing balls). Each value is its own array (all the positions, then all the velocities, etc.) in one malloc'd block, so moving them all is a tight loop over a few arrays.
+// The block is sized for the most any pattern uses and kept; patterns with fewer particles just use the start of each array.
+// Time is given once a frame by update, instead of each particle asking for it.
+class LEDParticles {
+private:
+    uint8_t *m_block;
+    uint16_t m_capacity;
+    uint16_t m_count;
+    uint32_t m_lastUpdateTime;
+
+    int32_t *m_positions;
+    int32_t *m_velocities;
+    int32_t *m_accelerations;
+    uint32_t *m_times; // what this is depends on the pattern; ie: when the ball last hit the ground
+    uint16_t *m_restitutions; // how much of the velocity is kept at a bounce; 65535 is all of it
+    CRGB *m_colors;
+
+    static uint32_t BlockSize(uint16_t capacity);
+    void setArrays();
+public:
+    LEDParticles() : m_block(NULL), m_capacity(0), m_count(0), m_lastUpdateTime(0) { setArrays(); }
+    ~LEDParticles();
+
+    // Makes sure there is room for capacity particles and removes any that were there. The block only grows; a smaller capacity reuses it. Returns false if there isn't enough RAM. Set the time before adding them.
+    bool allocate(uint16_t capacity);
+    void clear();
+    inline uint16_t getCapacity() { return m_capacity; }
+    inline uint16_t getCount() { return m_count; }
+    inline void removeAll() { m_count = 0; }
+
+    // Returns the new particle's index, or -1 if the pool is full. Its time is set to getTime(), and the restitution to all of it.
+    int add(int32_t position, int32_t velocity, int32_t acceleration, CRGB color);
+
+    // Moves everything forward to now: velocity by the acceleration, and position by the velocity.
+    // Positions wrap around wrapLength (in LEDs) when it isn't 0, for a strip that is a circle.
+    void update(uint32_t now, uint32_t wrapLength);
+    // The time of the last update; what patterns should use instead of millis()
+    inline uint32_t getTime() { return m_lastUpdateTime; }
+    inline void setTime(uint32_t time) { m_lastUpdateTime = time; }
+
+    // The arrays, getCount() long
+    inline int32_t *getPositions() { return m_positions; }
+    inline int32_t *getVelocities() { return m_velocities; }
+    inline int32_t *getAccelerations() { return m_accelerations; }
+    inline uint32_t *getTimes() { return m_times; }
+    inline uint16_t *getRestitutions() { return m_restitutions; }
+    inline CRGB *getColors() { return m_colors; }
+
+    // Snapshots have just the particles in use; restoring copies them into the pool (which only grows if it is too small)
+    static uint32_t SnapshotSize(uint16_t count);
+    inline uint32_t getSnapshotSize() { return SnapshotSize(m_count); }
+    void snapshot(void *data);
+    bool restore(const void *data, uint32_t size);
+    // Moves all the times forward by elapsed ms, so a restored pool continues where it left off instead of jumping
+    void rebaseTime(uint32_t elapsed);
+};
+
+#endif /* defined(__LEDDigitalCyrWheel__LEDParticles__) */
@@ -97,8 +97,31 @@ typedef CD_ENUM(int32_t, LEDPatternType) {
 
     LEDPatternTypeFadeInFadeOut,
     
+    // Transitions to the next pattern like LEDPatternTypeCrossfade, but each pixel switches over on its own at a precomputed threshold
+    LEDPatternTypeWipeTransition, // from the start of the strip to the end
+    LEDPatternTypeIrisTransition, // from the center out
+    LEDPatternTypeDissolveTransition, // random pixels
+    
+    // Audio reactive; these need LEDPatterns::setAudioSource, otherwise they are dark (or just the fire)
+    LEDPatternTypeAudioSpectrum, // a bar per band
+    LEDPatternTypeAudioBeatPulse, // the pattern color flashes on the beat
+    LEDPatternTypeAudioFire, // fire that sparks with the bass
+    
     LEDPatternTypeCount,
 };
+
+// How the fades go from off to on; each is y = f(x) from 0 to 1
+typedef CD_ENUM(uint8_t, LEDEasingType) {
+    LEDEasingTypeDefault = 0, // whatever the pattern always did
+    LEDEasingTypeLinear,
+    LEDEasingTypeQuadratic, // x^2
+    LEDEasingTypeCubic, // x^3
+    LEDEasingTypeSine, // slow at both ends
+    LEDEasingTypeExponential, // 2^(10(x - 1)); stays dim for a long time
+    LEDEasingTypeGamma, // x^2.2, so it looks linear to our eyes
+    
+    LEDEasingTypeCount,
+};
     
     
 typedef struct __attribute__((__packed__)) LEDBitmapPatternOptions {
@@ -119,6 +142,82 @@ typedef struct __attribute__((__packed__)) LEDBitmapPatternOptions {
     
 } LEDBitmapPatternOptions;
 
+// For the fire patterns
+typedef struct __attribute__((__packed__)) LEDFirePatternOptions {
+    uint32_t flameCount:4; // flames are spread around the strip, every other one going the other way so pairs meet at their tips; 0 is the default of 2
+    uint32_t reserved:28;
+    
+#ifdef __cplusplus
+    inline LEDFirePatternOptions(uint8_t flameCount) {
+        this->flameCount = flameCount;
+        this->reserved = 0;
+    }
+#endif
+    
+} LEDFirePatternOptions;
+
+// For LEDPatternTypeWave
+typedef struct __attribute__((__packed__)) LEDWavePatternOptions {
+    uint32_t waveCount:5; // 0 is the default of 4; up to 16
+    uint32_t randomOrigins:1; // where each wave starts is random, instead of evenly spaced around the strip
+    uint32_t reserved:26;
+    
+#ifdef __cplusplus
+    inline LEDWavePatternOptions(uint8_t waveCount, bool randomOrigins = false) {
+        this->waveCount = waveCount;
+        this->randomOrigins = randomOrigins;
+        this->reserved = 0;
+    }
+#endif
+    
+} LEDWavePatternOptions;
+
+// For LEDPatternTypeTheaterChase. Each color (LEDPatterns::setChaseColors, or just the pattern color) gets onCount LEDs followed by offCount off, and that repeats along the strip.
+typedef struct __attribute__((__packed__)) LEDChasePatternOptions {
+    uint32_t onCount:5; // 0 is the default of 1
+    uint32_t offCount:5; // 0 is the default of 4
+    uint32_t reverse:1; // chase toward the end of the strip instead of the start
+    uint32_t reserved:21;
+    
+#ifdef __cplusplus
+    inline LEDChasePatternOptions(uint8_t onCount, uint8_t offCount, bool reverse = false) {
+        this->onCount = onCount;
+        this->offCount = offCount;
+        this->reverse = reverse;
+        this->reserved = 0;
+    }
+#endif
+    
+} LEDChasePatternOptions;
+
+// For LEDPatternTypeFadeIn, LEDPatternTypeFadeOut and LEDPatternTypeFadeInFadeOut
+typedef struct __attribute__((__packed__)) LEDFadePatternOptions {
+    uint32_t easing:4; // LEDEasingType
+    uint32_t reserved:28;
+    
+#ifdef __cplusplus
+    inline LEDFadePatternOptions(LEDEasingType easing) {
+        this->easing = easing;
+        this->reserved = 0;
+    }
+#endif
+    
+} LEDFadePatternOptions;
+
+// For LEDPatternTypeCrossfade
+typedef struct __attribute__((__packed__)) LEDCrossfadePatternOptions {
+    uint32_t linearLight:1; // blends the light instead of the bytes, so it doesn't dip in the middle; a bit slower
+    uint32_t reserved:31;
+    
+#ifdef __cplusplus
+    inline LEDCrossfadePatternOptions(bool linearLight) {
+        this->linearLight = linearLight;
+        this->reserved = 0;
+    }
+#endif
+    
+} LEDCrossfadePatternOptions;
+
 
 // options that only apply to particular patterns, so I combine them all together. i could put the patternColor here as it only applies to certain patterns.
 // warning: keep at 32-bits for now! Or I have to expand the header
@@ -128,6 +227,11 @@ typedef struct __attribute__((__packed__)) LEDPatternOptions {
 #ifdef __cplusplus
     union {
         LEDBitmapPatternOptions bitmapOptions;
+        LEDFirePatternOptions fireOptions;
+        LEDWavePatternOptions waveOptions;
+        LEDChasePatternOptions chaseOptions;
+        LEDFadePatternOptions fadeOptions;
+        LEDCrossfadePatternOptions crossfadeOptions;
         uint32_t raw;
     };
 
@@ -137,6 +241,11 @@ typedef struct __attribute__((__packed__)) LEDPatternOptions {
     }
     
     inline LEDPatternOptions(LEDBitmapPatternOptions bOptions) : bitmapOptions(bOptions) { }
+    inline LEDPatternOptions(LEDFirePatternOptions fOptions) : fireOptions(fOptions) { }
+    inline LEDPatternOptions(LEDWavePatternOptions wOptions) : waveOptions(wOptions) { }
+    inline LEDPatternOptions(LEDChasePatternOptions cOptions) : chaseOptions(cOptions) { }
+    inline LEDPatternOptions(LEDFadePatternOptions fOptions) : fadeOptions(fOptions) { }
+    inline LEDPatternOptions(LEDCrossfadePatternOptions cOptions) : crossfadeOptions(cOptions) { }
     inline LEDPatternOptions(uint32_t raw) : raw(raw) { }
 #else
     // Ugh..... no easy way to do unions in swift. I need to figure out a better way to do this, or else just make this thing a bitset (maybe that is the best solution...
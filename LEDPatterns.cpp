@@ -34,155 +34,19 @@
 #define MIN min
 #endif
 
-class LEDStateInfo {
-public:
-    LEDStateInfo(int pos, int ledCount, int stateObjectCount, int velocity);
-    void initForBounce(int pos, int stateObjectCount); // for bounce
-    
-    void setLife(unsigned long life); // in seconds
-    void kill();
-    unsigned long age();
-    
-    // color can be set
-    void setColor(CRGB color) { m_color = color; }
-
-    void update(CRGB *leds, int ledCount); // should be called on each iteration
-    void updateBounceColor(CRGB *leds, int ledCount);
-private:
-	CRGB m_color;
-	int m_acceleration;
-	int m_velocity;
-  	int m_pos;
-	int m_LEDmm; // what is this for??
-	unsigned long m_birth;
-	unsigned long m_life;
-	unsigned long m_death;
-    
-	unsigned long m_lastUpdate;
-    float m_impact;
-    float m_cycle;
-    float m_cors;
-    float m_height;
-    bool alive();
-};
-
+#define NUMBER_LIFE_OBJECTS 0.10 // percentage, unless setParticleCount was called
+#define NUMBER_BOUNCE_OBJECTS 10 // unless setParticleCount was called
 
-LEDStateInfo::LEDStateInfo(int pos, int ledCount, int stateObjectCount, int velocity) {
-    m_color = CHSV((255/stateObjectCount)*pos, 255, 255);
-    m_LEDmm = 8; // TODO: what's this for?
-    m_pos = ((m_LEDmm * ledCount) / stateObjectCount) * pos;
-    m_velocity = velocity;
-    m_acceleration = -1;
-    m_lastUpdate = micros();
-    m_birth = m_lastUpdate;
-    m_life = 0;
-    m_death = m_birth + m_life;
-
-    if (velocity == 0) {
-        randomSeed(micros());
-        m_velocity = random(950, 1000);
-        randomSeed(micros());
-        m_acceleration = random(-1,-2);
-        randomSeed(micros());
-        if (random(2) == 1) {
-            m_velocity *= -1;
-            m_acceleration *= -1;
-        }
-    }
-}
+// Life was 1mm/s slower a frame at 8mm an LED; this is about that at 60 frames a second, in LEDs a second a second
+#define LIFE_DECELERATION (LED_PARTICLE_ONE * 15 / 2)
+// and its speeds were in mm a second
+#define LIFE_SPEED_FROM_MM(a) ((int32_t)(a) * (LED_PARTICLE_ONE / 8))
 
-#define GRAVITY           -9.81              // Downward (negative) acceleration of gravity in m/s^2
+// The balls are in meters and seconds, in 16.16
+#define GRAVITY           642908             // Downward acceleration of gravity, 9.81 m/s^2
 #define BOUNCE_HEIGHT                5                  // Starting height, in meters, of the ball (strip length)
-const float vImpact0 = sqrt( -2 * GRAVITY * BOUNCE_HEIGHT );  // Impact velocity of the ball when it hits the ground if "dropped" from the top of the strip
-
-void LEDStateInfo::initForBounce(int pos, int stateObjectCount) {
-    m_lastUpdate = millis();
-    m_height = BOUNCE_HEIGHT;
-    m_pos = 0;                              // Balls start on the ground
-    m_impact = vImpact0;             // And "pop" up at vImpact0
-    m_cors = 0.90 - float(pos)/pow(stateObjectCount,2);
-    m_impact = m_cors * m_impact ;   // and recalculate its new upward velocity as it's old velocity * COR
-    m_cycle = 0;
-}
-
-int circMod(int x, int m) {
-    return (x%m + m)%m;
-}
-
-void LEDStateInfo::update(CRGB *leds, int ledCount) {
-    if (alive()) {
-        unsigned long now = micros();
-        m_velocity += m_acceleration;
-        m_pos += m_velocity * ((now-m_lastUpdate)/1000000.0);
-        m_lastUpdate = now;
-    }
-
-    // was fireUpObj.
-    // corbin: when does vel change to 0??? it starts out non zero..so I don't know when this would get executed..
-    if (abs(m_velocity) == 0) {
-        randomSeed(micros());
-        m_velocity = random(950, 1000);
-        randomSeed(micros());
-        m_acceleration = random(-1,-2);
-        randomSeed(micros());
-        if (random(2) == 1) {
-            m_velocity *= -1;
-            m_acceleration *= -1;
-        }
-    }
-    
-    // was the iteration
-    if (alive()) {
-        int objectSize = abs(m_velocity/100);
-        if (objectSize == 0) { objectSize = 1; }
-        int ledPos = m_pos / m_LEDmm;
-        int pos = ledPos;
-        for (int x = 0; x <= objectSize; x++){
-            if (m_velocity > 0) {
-                leds[circMod(pos-x, ledCount)] += m_color % (uint8_t)(255-((255/objectSize)*x));
-            } else {
-                leds[circMod(pos+x, ledCount)] += m_color % (uint8_t)(255-((255/objectSize)*x));
-            }
-        }
-    }
-}
-
-// https://github.com/fibonacci162/LEDs/blob/master/BouncingBalls2014/BouncingBalls2014.ino
-void LEDStateInfo::updateBounceColor(CRGB *leds, int ledCount) {
-    m_cycle =  millis() - m_lastUpdate ;     // Calculate the time since the last time the ball was on the ground
-    
-    // A little kinematics equation calculates positon as a function of time, acceleration (gravity) and intial velocity
-    m_height = 0.5 * GRAVITY * pow( m_cycle/1000 , 2.0 ) + m_impact * m_cycle/1000;
-    
-    if ( m_height < 0 ) {
-        m_height = 0;                            // If the ball crossed the threshold of the "ground," put it back on the ground
-        m_impact = m_cors * m_impact ;   // and recalculate its new upward velocity as it's old velocity * COR
-        m_lastUpdate = millis();
-        
-        if ( m_impact < 0.01 ) m_impact = vImpact0;  // If the ball is barely moving, "pop" it back up at vImpact0
-    }
-    m_pos = round( m_height * (ledCount - 1) / BOUNCE_HEIGHT);
-    leds[m_pos] = m_color;
-}
-
-// in seconds
-void LEDStateInfo::setLife(unsigned long life) {
-    m_life = life * 1000;
-    m_death = m_birth + m_life;
-}
-
-bool LEDStateInfo::alive() {
-    unsigned long now = micros();
-    if (now < m_death || m_life == 0) {
-        return true;
-    } else {
-        return false;
-    }
-}
-
-void LEDStateInfo::kill() {
-    m_death = micros();
-}
+#define IMPACT0           649104             // Impact velocity of the ball when it hits the ground if "dropped" from the top of the strip; sqrt(2 * 9.81 * 5)
+#define MIN_IMPACT        655                // 0.01 m/s; any slower and it is popped back up
 
 // What do I mean by continuous??
 // I mean to reset the percentage back to 0 once it goes past 1.0 IF this returns false. If it returns true, the value will go past 100% continuously forever.
@@ -244,7 +108,14 @@ static inline bool _PatternIsContinuous(LEDPatternType p) {
             // restarts every duration and generates a new seed/pattern
             return false;
         case LEDPatternTypeCrossfade:
+        case LEDPatternTypeWipeTransition:
+        case LEDPatternTypeIrisTransition:
+        case LEDPatternTypeDissolveTransition:
             return false;
+        case LEDPatternTypeAudioSpectrum:
+        case LEDPatternTypeAudioBeatPulse:
+        case LEDPatternTypeAudioFire:
+            return true;
         case LEDPatternTypeLife:
         case LEDPatternTypeLifeDynamic:
         case LEDPatternTypeBouncingBall:
@@ -256,33 +127,134 @@ static inline bool _PatternIsContinuous(LEDPatternType p) {
     }
 }
 
+// Returns the pattern type a snapshot blob is for
+static inline LEDPatternType _SnapshotPatternType(const uint8_t *blob);
+
 // This always resets things, so only change it when necessary
 void LEDPatterns::setPatternType(LEDPatternType type) {
+    if (m_transitionOutgoing) {
+        if (PatternIsTransition(type)) {
+            if (PatternIsTransition(m_patternType)) {
+                // Transitioning in the middle of a transition; the pattern that was coming in becomes the one going out
+                if (m_transitionIncomingValid) {
+                    uint8_t *tmp = m_transitionOutgoing;
+                    m_transitionOutgoing = m_transitionIncoming;
+                    m_transitionIncoming = tmp;
+                    m_transitionOutgoingValid = true;
+#if SD_CARD_SUPPORT
+                    releaseTransitionOutgoingBitmap(); // the one coming in has the current bitmap
+#endif
+                }
+            } else {
+                // Keep the current pattern alive so it can keep animating while it goes out
+                m_transitionOutgoingValid = snapshotState(m_transitionOutgoing, m_transitionSlotSize) != 0;
+            }
+            m_transitionIncomingValid = false;
+        } else if (PatternIsTransition(m_patternType) && m_transitionIncomingValid && _SnapshotPatternType(m_transitionIncoming) == type) {
+            // The transition has been running this pattern already; continue it instead of restarting it
+            _restoreState(m_transitionIncoming, m_transitionSlotSize, true);
+            m_transitionOutgoingValid = false;
+            m_transitionIncomingValid = false;
+#if SD_CARD_SUPPORT
+            releaseTransitionOutgoingBitmap();
+#endif
+            return;
+        } else {
+            m_transitionOutgoingValid = false;
+            m_transitionIncomingValid = false;
+#if SD_CARD_SUPPORT
+            releaseTransitionOutgoingBitmap();
+#endif
+        }
+    }
     m_patternType = type;
     m_startTime = millis();
     m_firstTime = true;
     m_stateInfoCount = 0;
     m_loopCount = 0;
     m_count = 0;
+    m_random.setStream(m_randomSeed++, type);
+    m_seed = m_random.next(); // for the patterns that use LEDRandom::Hash
+}
+
+
+#if SD_CARD_SUPPORT
+void LEDPatterns::releaseTransitionOutgoingBitmap() {
+    if (m_transitionOutgoingBitmap) {
+        delete m_transitionOutgoingBitmap;
+        m_transitionOutgoingBitmap = NULL;
+    }
+}
+
+void LEDPatterns::setBitmap(CDPatternBitmap *bitmap) {
+    if (m_lazyBitmap && m_lazyBitmap != bitmap) {
+        if (PatternIsTransition(m_patternType) && m_transitionOutgoingValid && m_transitionOutgoingBitmap == NULL) {
+            // The pattern going out still draws from it
+            m_transitionOutgoingBitmap = m_lazyBitmap;
+        } else {
+            delete m_lazyBitmap; // releases the shared buffer for the new one
+        }
+    }
+    m_lazyBitmap = bitmap;
+    if (m_lazyBitmap) {
+        if (m_transitionOutgoingBitmap && !m_lazyBitmap->prepareBuffer()) {
+            // Not enough RAM for both; the transition goes from a still frame instead
+            DEBUG_PRINTLN("not enough RAM to keep the outgoing bitmap");
+            releaseTransitionOutgoingBitmap();
+            m_transitionOutgoingValid = false;
+        }
+        if (m_transitionOutgoing) {
+            // Its own row buffers, so a transition's other side using the temp buffers doesn't mean reading the rows again every frame
+            m_lazyBitmap->finishLoading(NULL, NULL, 0);
+        } else {
+            m_lazyBitmap->finishLoading(getTempBuffer1(), getTempBuffer2(), getBufferSize());
+        }
+    }
+}
+#endif
+
+void LEDPatterns::setNextPatternType(LEDPatternType nextType) {
+    if (nextType != m_nextPatternType) {
+        // A different pattern has to start over when it fades in
+        m_transitionIncomingValid = false;
+    }
+    m_nextPatternType = nextType;
+}
+
+void LEDPatterns::preparePatternType(LEDPatternType type) {
+    uint8_t tempBufferMask = PatternTempBufferStateMask(type);
+#if SD_CARD_SUPPORT
+    // Bitmaps use both for their rows, when they are big enough
+    if (type == LEDPatternTypeBitmap || type == LEDPatternTypeImageReferencedBitmap) {
+        tempBufferMask = 1|2;
+    }
+#endif
+    if (tempBufferMask & 1) {
+        getTempBuffer1();
+    }
+    if (tempBufferMask & 2) {
+        getTempBuffer2();
+    }
 }
 
+// 0..255 for how far through a fade (0 to 1), through the curve in the fade options or defaultEasing if they don't have one
+static uint8_t easedFadeLevel(LEDPatternOptions options, LEDEasingType defaultEasing, float percentage) {
+    LEDEasingType easing = (LEDEasingType)options.fadeOptions.easing;
+    if (easing == LEDEasingTypeDefault) {
+        easing = defaultEasing;
+    }
+    if (percentage <= 0) {
+        return 0;
+    } else if (percentage >= 1.0) {
+        return 255;
+    }
+    return LEDEasing::Ease(easing, round(percentage * 255));
+}
 
 void LEDPatterns::updateLEDsForPatternType(LEDPatternType patternType) {
 //    DEBUG_PRINTF("updateLEDsForPatternType: %d\n", patternType);
     // for polulu
     unsigned int maxLoops = 0;  // go to next state when m_ledCount >= maxLoops
-    // Only update based on the real type...
-    if (m_patternType == LEDPatternTypeWarmWhiteShimmer || m_patternType == LEDPatternTypeRandomColorWalk)
-    {
-        // for these two patterns, we want to make sure we get the same
-        // random sequence six times in a row (this provides smoother
-        // random fluctuations in brightness/color)
-        if (m_loopCount % 6 == 0)
-        {
-            m_seed = random(30000);
-        }
-        randomSeed(m_seed);
-    }
     
     // Switch based ont he patternType
     switch (patternType) {
@@ -308,20 +280,16 @@ void LEDPatterns::updateLEDsForPatternType(LEDPatternType patternType) {
         }
         case LEDPatternTypeFadeInFadeOut: {
             float percentagePassed = getPercentagePassed();
+            uint8_t level;
             if (percentagePassed <= 0.5) {
-                float fadeInPercentage = percentagePassed / 0.5;
-                fract8 v = round(fadeInPercentage*UINT8_MAX);
-                for (int i = 0; i < m_ledCount; i++) {
-                    m_leds[i] = blend(CRGB::Black, m_patternColor, v);
-                }
-
+                level = easedFadeLevel(m_patternOptions, LEDEasingTypeLinear, percentagePassed / 0.5);
             } else {
-                float fadeOutPercentage = (percentagePassed - 0.5) / 0.5;
-                fract8 v = round(fadeOutPercentage*UINT8_MAX);
-                for (int i = 0; i < m_ledCount; i++) {
-                    m_leds[i] = blend(m_patternColor, CRGB::Black, v);
-                }
+                level = 255 - easedFadeLevel(m_patternOptions, LEDEasingTypeLinear, (percentagePassed - 0.5) / 0.5);
             }
+            // Every LED is the same, so it is only scaled once
+            CRGB c = m_patternColor;
+            LEDEasing::ScaleLEDs(&c, &c, 1, level);
+            fill_solid(m_leds, m_ledCount, c);
             break;
         }
         case LEDPatternTypeDoNothing: {
@@ -489,8 +457,15 @@ void LEDPatterns::updateLEDsForPatternType(LEDPatternType patternType) {
             flagEffect();
             break;
         }
-        case LEDPatternTypeCrossfade: {
-            crossFadeToNextPattern();
+        case LEDPatternTypeCrossfade:
+        case LEDPatternTypeWipeTransition:
+        case LEDPatternTypeIrisTransition:
+        case LEDPatternTypeDissolveTransition: {
+            if (m_transitionOutgoing) {
+                liveTransitionToNextPattern();
+            } else {
+                transitionToNextPattern();
+            }
             break;
         }case LEDPatternTypeSinWave: {
             sinWaveDemoEffect();
@@ -512,6 +487,18 @@ void LEDPatterns::updateLEDsForPatternType(LEDPatternType patternType) {
             bouncingBallPattern();
             break;
         }
+        case LEDPatternTypeAudioSpectrum: {
+            audioSpectrumPattern();
+            break;
+        }
+        case LEDPatternTypeAudioBeatPulse: {
+            audioBeatPulsePattern();
+            break;
+        }
+        case LEDPatternTypeAudioFire: {
+            audioFirePattern();
+            break;
+        }
 #if SD_CARD_SUPPORT
         case LEDPatternTypeBitmap: {
             bitmapPattern();
@@ -559,6 +546,21 @@ bool LEDPatterns::PatternDurationShouldBeEqualToSegmentDuration(LEDPatternType p
         case LEDPatternTypeFadeOut:
         case LEDPatternTypeColorWipe: // maybe??
         case LEDPatternTypeCrossfade:
+        case LEDPatternTypeWipeTransition:
+        case LEDPatternTypeIrisTransition:
+        case LEDPatternTypeDissolveTransition:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool LEDPatterns::PatternIsTransition(LEDPatternType p) {
+    switch (p) {
+        case LEDPatternTypeCrossfade:
+        case LEDPatternTypeWipeTransition:
+        case LEDPatternTypeIrisTransition:
+        case LEDPatternTypeDissolveTransition:
             return true;
         default:
             return false;
@@ -589,6 +591,9 @@ bool LEDPatterns::PatternNeedsDuration(LEDPatternType p) {
         case LEDPatternTypeBlink:
             return true;
         case LEDPatternTypeCrossfade:
+        case LEDPatternTypeWipeTransition:
+        case LEDPatternTypeIrisTransition:
+        case LEDPatternTypeDissolveTransition:
         case LEDPatternTypeWarmWhiteShimmer:
         case LEDPatternTypeRandomColorWalk:
         case LEDPatternTypeTraditionalColors:
@@ -611,6 +616,9 @@ bool LEDPatterns::PatternNeedsDuration(LEDPatternType p) {
         case LEDPatternTypeLifeDynamic:
         case LEDPatternTypeBouncingBall:
         case LEDPatternTypeFunkyClouds:
+        case LEDPatternTypeAudioSpectrum:
+        case LEDPatternTypeAudioBeatPulse:
+        case LEDPatternTypeAudioFire:
             return false;
         default:
             return false;
@@ -618,6 +626,16 @@ bool LEDPatterns::PatternNeedsDuration(LEDPatternType p) {
 }
 
 void LEDPatterns::_showFromTime(uint32_t now) {
+    m_needsInternalShow = true;
+    _updatePatternFromTime(now);
+    // Some patterns may not need to do any more show work after doing it once.
+    if (m_needsInternalShow) {
+        showOutput();
+    }
+}
+
+void LEDPatterns::_updatePatternFromTime(uint32_t now) {
+    m_frameTime = now;
     // The inital tick always starts with 0
     if (m_startTime > now) {
         m_startTime = now; // roll over..
@@ -637,12 +655,7 @@ void LEDPatterns::_showFromTime(uint32_t now) {
         }
     }
     
-    m_needsInternalShow = true;
     updateLEDsForPatternType(m_patternType);
-    // Some patterns may not need to do any more show work after doing it once.
-    if (m_needsInternalShow) {
-        internalShow();
-    }
     // no longer the first time
     m_firstTime = false;
 }
@@ -747,6 +760,247 @@ void LEDPatterns::pause() {
     }
 }
 
+uint8_t LEDPatterns::PatternTempBufferStateMask(LEDPatternType p) {
+    switch (p) {
+        case LEDPatternTypeFadeOut:
+        case LEDPatternTypeRandomGradients:
+            return 1;
+        case LEDPatternTypeWave:
+            return 1; // each wave's origin and color
+        case LEDPatternTypeTheaterChase:
+            return 1; // the chase's tile
+        case LEDPatternTypeFire:
+        case LEDPatternTypeBlueFire:
+        case LEDPatternTypeLavaFire:
+        case LEDPatternTypeRainbowFire:
+        case LEDPatternTypeAudioFire:
+            return 1; // all the flames are in buffer 1
+        case LEDPatternTypeCrossfade:
+        case LEDPatternTypeWipeTransition:
+        case LEDPatternTypeIrisTransition:
+        case LEDPatternTypeDissolveTransition:
+            return 1 | 2;
+        default:
+            // Bitmaps reload their row buffers from the offsets
+            return 0;
+    }
+}
+
+bool LEDPatterns::PatternUsesParticles(LEDPatternType p) {
+    switch (p) {
+        case LEDPatternTypeLife:
+        case LEDPatternTypeLifeDynamic:
+        case LEDPatternTypeBouncingBall:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The patterns that draw from m_lazyBitmap
+static inline bool _PatternUsesBitmap(LEDPatternType p) {
+    switch (p) {
+#if SD_CARD_SUPPORT
+        case LEDPatternTypeImageReferencedBitmap:
+        case LEDPatternTypeImageEntireStrip_UNUSED:
+        case LEDPatternTypeBitmap:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+#define LED_STATE_SNAPSHOT_MAGIC 0x4C505334 // 'LPS4'
+
+// Header for the snapshot blob. It is followed by the LEDs, temp buffer 1 and 2 (if the bits are set) and then the particles.
+typedef struct {
+    uint32_t magic;
+    uint32_t ledCount;
+    LEDPatternType patternType;
+    LEDPatternType nextPatternType;
+    uint32_t duration;
+    uint32_t timePassed; // how far into the pattern we were
+    uint32_t snapshotTime; // millis() when taken, so state objects can be moved forward on restore
+    uint32_t timedPatternAge;
+    CRGB patternColor;
+    LEDPatternOptions patternOptions;
+    
+    uint32_t initialPixel;
+    uint32_t initialPixel1;
+    uint32_t initialPixel2;
+    uint32_t initialPixel3;
+    
+    uint32_t loopCount;
+    uint32_t seed;
+    uint32_t state;
+    uint32_t count;
+    uint32_t randomState; // so the pattern continues with the same random numbers
+    
+    int32_t stateInfoCount;
+    int32_t bitmapXOffset;
+    int32_t bitmapYOffset;
+    
+    uint32_t firstTime:1;
+    uint32_t hasTempBuffer1:1;
+    uint32_t hasTempBuffer2:1;
+    uint32_t hasParticles:1;
+    uint32_t hasBitmap:1;
+    uint32_t reserved:27;
+} LEDPatternStateHeader;
+
+uint32_t LEDPatterns::getStateSnapshotSize() {
+    uint32_t result = sizeof(LEDPatternStateHeader) + getBufferSize();
+    uint8_t tempBufferMask = PatternTempBufferStateMask(m_patternType);
+    if ((tempBufferMask & 1) && m_ledTempBuffer1) {
+        result += getBufferSize();
+    }
+    if ((tempBufferMask & 2) && m_ledTempBuffer2) {
+        result += getBufferSize();
+    }
+    if (PatternUsesParticles(m_patternType)) {
+        result += m_particles.getSnapshotSize();
+    }
+    return result;
+}
+
+uint32_t LEDPatterns::snapshotState(void *blob, uint32_t blobSize) {
+    uint32_t size = getStateSnapshotSize();
+    if (blob == NULL || blobSize < size) {
+        return 0;
+    }
+    uint32_t now = isPaused() ? getPauseTime() : millis();
+    uint8_t tempBufferMask = PatternTempBufferStateMask(m_patternType);
+
+    LEDPatternStateHeader *header = (LEDPatternStateHeader *)blob;
+    header->magic = LED_STATE_SNAPSHOT_MAGIC;
+    header->ledCount = m_ledCount;
+    header->patternType = m_patternType;
+    header->nextPatternType = m_nextPatternType;
+    header->duration = m_duration;
+    header->timePassed = m_firstTime ? 0 : now - m_startTime;
+    header->snapshotTime = now;
+    header->timedPatternAge = now - m_timedPattern;
+    header->patternColor = m_patternColor;
+    header->patternOptions = m_patternOptions;
+    header->initialPixel = m_initialPixel;
+    header->initialPixel1 = m_initialPixel1;
+    header->initialPixel2 = m_initialPixel2;
+    header->initialPixel3 = m_initialPixel3;
+    header->loopCount = m_loopCount;
+    header->seed = m_seed;
+    header->state = m_state;
+    header->count = m_count;
+    header->randomState = m_random.getState();
+    header->stateInfoCount = m_stateInfoCount;
+    header->firstTime = m_firstTime;
+    header->hasTempBuffer1 = (tempBufferMask & 1) && m_ledTempBuffer1;
+    header->hasTempBuffer2 = (tempBufferMask & 2) && m_ledTempBuffer2;
+    header->hasParticles = PatternUsesParticles(m_patternType);
+    header->hasBitmap = m_lazyBitmap != NULL && _PatternUsesBitmap(m_patternType);
+    header->bitmapXOffset = m_lazyBitmap ? m_lazyBitmap->getXOffset() : 0;
+    header->bitmapYOffset = m_lazyBitmap ? m_lazyBitmap->getYOffset() : 0;
+    header->reserved = 0;
+    
+    uint8_t *data = (uint8_t *)blob + sizeof(LEDPatternStateHeader);
+    memcpy(data, m_leds, getBufferSize());
+    data += getBufferSize();
+    if (header->hasTempBuffer1) {
+        memcpy(data, m_ledTempBuffer1, getBufferSize());
+        data += getBufferSize();
+    }
+    if (header->hasTempBuffer2) {
+        memcpy(data, m_ledTempBuffer2, getBufferSize());
+        data += getBufferSize();
+    }
+    if (header->hasParticles) {
+        m_particles.snapshot(data);
+    }
+    return size;
+}
+
+static inline LEDPatternType _SnapshotPatternType(const uint8_t *blob) {
+    return ((const LEDPatternStateHeader *)blob)->patternType;
+}
+
+static inline CRGB *_SnapshotLEDs(uint8_t *blob) {
+    return (CRGB *)(blob + sizeof(LEDPatternStateHeader));
+}
+
+// Big enough for any pattern's snapshot
+uint32_t LEDPatterns::getMaxStateSnapshotSize() {
+    return sizeof(LEDPatternStateHeader) + 3*getBufferSize() + LEDParticles::SnapshotSize(getMaxParticleCount());
+}
+
+bool LEDPatterns::restoreState(const void *blob, uint32_t blobSize) {
+    // Restoring continues the pattern from the moment it was snapshotted
+    return _restoreState(blob, blobSize, false);
+}
+
+// keepClockRunning is for the transition slots; the pattern's time keeps passing while it isn't current, instead of resuming where it was
+bool LEDPatterns::_restoreState(const void *blob, uint32_t blobSize, bool keepClockRunning) {
+    const LEDPatternStateHeader *header = (const LEDPatternStateHeader *)blob;
+    if (blob == NULL || blobSize < sizeof(LEDPatternStateHeader) || header->magic != LED_STATE_SNAPSHOT_MAGIC || header->ledCount != m_ledCount) {
+        return false;
+    }
+    uint32_t expectedSize = sizeof(LEDPatternStateHeader) + getBufferSize();
+    if (header->hasTempBuffer1) expectedSize += getBufferSize();
+    if (header->hasTempBuffer2) expectedSize += getBufferSize();
+    if (blobSize < expectedSize) {
+        return false;
+    }
+    
+    uint32_t now = keepClockRunning ? header->snapshotTime : isPaused() ? getPauseTime() : millis();
+    m_patternType = header->patternType;
+    m_nextPatternType = header->nextPatternType;
+    m_duration = header->duration;
+    m_startTime = now - header->timePassed;
+    m_firstTime = header->firstTime;
+    m_timedPattern = now - header->timedPatternAge;
+    m_patternColor = header->patternColor;
+    m_patternOptions = header->patternOptions;
+    m_initialPixel = header->initialPixel;
+    m_initialPixel1 = header->initialPixel1;
+    m_initialPixel2 = header->initialPixel2;
+    m_initialPixel3 = header->initialPixel3;
+    m_loopCount = header->loopCount;
+    m_seed = header->seed;
+    m_state = header->state;
+    m_count = header->count;
+    m_random.setState(header->randomState);
+    
+    const uint8_t *data = (const uint8_t *)blob + sizeof(LEDPatternStateHeader);
+    memcpy(m_leds, data, getBufferSize());
+    data += getBufferSize();
+    if (header->hasTempBuffer1) {
+        memcpy(getTempBuffer1(), data, getBufferSize());
+        data += getBufferSize();
+    }
+    if (header->hasTempBuffer2) {
+        memcpy(getTempBuffer2(), data, getBufferSize());
+        data += getBufferSize();
+    }
+    if (header->hasParticles && m_particles.restore(data, blobSize - expectedSize)) {
+        // The particles go back into the same pool; this is what avoids redoing commonInitForPattern
+        m_particles.rebaseTime(now - header->snapshotTime);
+    } else if (PatternUsesParticles(m_patternType)) {
+        // Nothing was there when the snapshot was taken, or no RAM for it; start it over
+        m_firstTime = true;
+    }
+    m_stateInfoCount = header->stateInfoCount;
+    
+    // The bitmap itself isn't part of the snapshot; put the current one back at the same spot
+    if (header->hasBitmap && m_lazyBitmap) {
+        m_lazyBitmap->setXOffset(header->bitmapXOffset);
+        // The rows are only read again when it is at a different row, or they are in the temp buffers (which another pattern may have used since)
+        if (header->bitmapYOffset >= 0 && (header->bitmapYOffset != m_lazyBitmap->getYOffset() || m_lazyBitmap->hasRowsIn(m_ledTempBuffer1) || m_lazyBitmap->hasRowsIn(m_ledTempBuffer2))) {
+            m_lazyBitmap->setYOffset(header->bitmapYOffset);
+            m_lazyBitmap->updateBuffersWithYOffset(m_lazyBitmap->getYOffset(), -1);
+        }
+    }
+    return true;
+}
+
 // pololu... https://github.com/pololu/pololu-led-strip-arduino/blob/master/PololuLedStrip/examples/LedStripXmas/LedStripXmas.ino
 
 
@@ -760,9 +1014,10 @@ void LEDPatterns::pause() {
 // will always decrease; when directions is 2, val will have a 50% chance
 // of increasing and a 50% chance of decreasing; when directions is 3,
 // val has an equal chance of increasing, decreasing, or staying the same.
-static void randomWalk(unsigned char *val, unsigned char maxVal, unsigned char changeAmount, unsigned char directions)
+// randomValue picks the direction; it is a hash so the caller can decide what it repeats for.
+static void randomWalk(uint32_t randomValue, unsigned char *val, unsigned char maxVal, unsigned char changeAmount, unsigned char directions)
 {
-    unsigned char walk = random(directions);  // direction of random walk
+    unsigned char walk = ((uint64_t)randomValue * directions) >> 32;  // direction of random walk
     if (walk == 0)
     {
         // decrease val by changeAmount down to a min of 0
@@ -852,9 +1107,12 @@ void LEDPatterns::randomColorWalk(unsigned char initializeColors, unsigned char
         {
             // randomly walk existing colors of every seventh LED
             // (neighboring LEDs to these will be dimmer versions of the same color)
-            randomWalk(&m_leds[i].red, maxBrightness, changeAmount, dimOnly ? 1 : 3);
-            randomWalk(&m_leds[i].green, maxBrightness, changeAmount, dimOnly ? 1 : 3);
-            randomWalk(&m_leds[i].blue, maxBrightness, changeAmount, dimOnly ? 1 : 3);
+            // The same direction is used six loops in a row (this provides smoother
+            // random fluctuations in color)
+            uint32_t step = m_loopCount / 6;
+            randomWalk(LEDRandom::Hash(m_seed, 3*i, step), &m_leds[i].red, maxBrightness, changeAmount, dimOnly ? 1 : 3);
+            randomWalk(LEDRandom::Hash(m_seed, 3*i + 1, step), &m_leds[i].green, maxBrightness, changeAmount, dimOnly ? 1 : 3);
+            randomWalk(LEDRandom::Hash(m_seed, 3*i + 2, step), &m_leds[i].blue, maxBrightness, changeAmount, dimOnly ? 1 : 3);
         }
         else if (initializeColors == 1)
         {
@@ -873,7 +1131,7 @@ void LEDPatterns::randomColorWalk(unsigned char initializeColors, unsigned char
         else
         {
             // initialize LEDs to a string of random m_leds
-            m_leds[i] = CRGB((byte)random(maxBrightness), (byte)random(maxBrightness), (byte)random(maxBrightness));
+            m_leds[i] = CRGB((byte)m_random.random(maxBrightness), (byte)m_random.random(maxBrightness), (byte)m_random.random(maxBrightness));
         }
         
         // set neighboring LEDs to be progressively dimmer versions of the color we just set
@@ -1029,10 +1287,10 @@ static void brightTwinkleColorAdjust(unsigned char *color)
 // is 31 (chance is: 1 - 1/(propChance+1)).  The neighboring LED m_leds
 // are pointed to by leftColor and rightColor (it is not important that
 // the leftColor LED actually be on the "left" in your setup).
-static void colorExplosionColorAdjust(unsigned char *color, unsigned char propChance,
+static void colorExplosionColorAdjust(LEDRandom *random, unsigned char *color, unsigned char propChance,
                                unsigned char *leftColor, unsigned char *rightColor)
 {
-    if (*color == 31 && random(propChance+1) != 0)
+    if (*color == 31 && random->random(propChance+1) != 0)
     {
         if (leftColor != 0 && *leftColor == 0)
         {
@@ -1070,22 +1328,22 @@ void LEDPatterns::colorExplosion(bool noNewBursts)
     }
 #endif
     // adjust the colors of the first LED
-    colorExplosionColorAdjust(&m_leds[0].red, 9, (unsigned char*)0, &m_leds[1].red);
-    colorExplosionColorAdjust(&m_leds[0].green, 9, (unsigned char*)0, &m_leds[1].green);
-    colorExplosionColorAdjust(&m_leds[0].blue, 9, (unsigned char*)0, &m_leds[1].blue);
+    colorExplosionColorAdjust(&m_random, &m_leds[0].red, 9, (unsigned char*)0, &m_leds[1].red);
+    colorExplosionColorAdjust(&m_random, &m_leds[0].green, 9, (unsigned char*)0, &m_leds[1].green);
+    colorExplosionColorAdjust(&m_random, &m_leds[0].blue, 9, (unsigned char*)0, &m_leds[1].blue);
     
     for (int i = 1; i < m_ledCount - 1; i++)
     {
         // adjust the m_leds of second through second-to-last LEDs
-        colorExplosionColorAdjust(&m_leds[i].red, 9, &m_leds[i-1].red, &m_leds[i+1].red);
-        colorExplosionColorAdjust(&m_leds[i].green, 9, &m_leds[i-1].green, &m_leds[i+1].green);
-        colorExplosionColorAdjust(&m_leds[i].blue, 9, &m_leds[i-1].blue, &m_leds[i+1].blue);
+        colorExplosionColorAdjust(&m_random, &m_leds[i].red, 9, &m_leds[i-1].red, &m_leds[i+1].red);
+        colorExplosionColorAdjust(&m_random, &m_leds[i].green, 9, &m_leds[i-1].green, &m_leds[i+1].green);
+        colorExplosionColorAdjust(&m_random, &m_leds[i].blue, 9, &m_leds[i-1].blue, &m_leds[i+1].blue);
     }
     
     // adjust the m_leds of the last LED
-    colorExplosionColorAdjust(&m_leds[m_ledCount-1].red, 9, &m_leds[m_ledCount-2].red, (unsigned char*)0);
-    colorExplosionColorAdjust(&m_leds[m_ledCount-1].green, 9, &m_leds[m_ledCount-2].green, (unsigned char*)0);
-    colorExplosionColorAdjust(&m_leds[m_ledCount-1].blue, 9, &m_leds[m_ledCount-2].blue, (unsigned char*)0);
+    colorExplosionColorAdjust(&m_random, &m_leds[m_ledCount-1].red, 9, &m_leds[m_ledCount-2].red, (unsigned char*)0);
+    colorExplosionColorAdjust(&m_random, &m_leds[m_ledCount-1].green, 9, &m_leds[m_ledCount-2].green, (unsigned char*)0);
+    colorExplosionColorAdjust(&m_random, &m_leds[m_ledCount-1].blue, 9, &m_leds[m_ledCount-2].blue, (unsigned char*)0);
     
     if (!noNewBursts)
     {
@@ -1093,9 +1351,9 @@ void LEDPatterns::colorExplosion(bool noNewBursts)
         // to light up
         for (int i = 0; i < 1; i++)
         {
-            int j = random(m_ledCount);  // randomly pick an LED
+            int j = m_random.random(m_ledCount);  // randomly pick an LED
             
-            switch(random(7))  // randomly pick a color
+            switch(m_random.random(7))  // randomly pick a color
             {
                     // 2/7 chance we will spawn a red burst here (if LED has no red component)
                 case 0:
@@ -1287,14 +1545,14 @@ void LEDPatterns::brightTwinkle(unsigned char minColor, unsigned char numColors,
         // to light up
         for (int i = 0; i < 4; i++)
         {
-            int j = random(m_ledCount);
+            int j = m_random.random(m_ledCount);
             if (m_leds[j].red == 0 && m_leds[j].green == 0 && m_leds[j].blue == 0)
             {
                 // if the LED we picked is not already lit, pick a random
                 // color for it and seed it so that it will start getting
                 // brighter in that color
                 CRGB c = CRGB(0, 0, 0);
-                switch (random(numColors) + minColor)
+                switch (m_random.random(numColors) + minColor)
                 {
                     case 0:
                         c.red = 1;
@@ -1386,9 +1644,9 @@ unsigned char LEDPatterns::collision()
                 firstColor.blue = maxBrightness >> 3;
                 break;
             default:  // fifth collision and beyond: random-color streams
-                firstColor.red = static_cast<uint8_t>(random(maxBrightness));
-                firstColor.green = static_cast<uint8_t>(random(maxBrightness));
-                firstColor.blue = static_cast<uint8_t>(random(maxBrightness));
+                firstColor.red = static_cast<uint8_t>(m_random.random(maxBrightness));
+                firstColor.green = static_cast<uint8_t>(m_random.random(maxBrightness));
+                firstColor.blue = static_cast<uint8_t>(m_random.random(maxBrightness));
                 break;
                 
         }
@@ -1523,11 +1781,14 @@ void LEDPatterns::warmWhiteShimmer()
     const unsigned char maxBrightness = 120;  // cap on LED brighness
     const unsigned char changeAmount = 2;   // size of random walk step
     
+    // The same direction is used six loops in a row (this provides smoother
+    // random fluctuations in brightness)
+    uint32_t step = m_loopCount / 6;
     for (int i = 0; i < m_ledCount; i += 2)
     {
         // randomly walk the brightness of every even LED
         // g r b
-        randomWalk(&m_leds[i].red, maxBrightness, changeAmount, dimOnly ? 1 : 2);
+        randomWalk(LEDRandom::Hash(m_seed, i, step), &m_leds[i].red, maxBrightness, changeAmount, dimOnly ? 1 : 2);
         
         
         // warm white: red = x, green = 0.8x, blue = 0.125x
@@ -1546,193 +1807,139 @@ void LEDPatterns::warmWhiteShimmer()
     }
 }
 
-#define WRAP_AROUND(pixel, count) if (pixel < 0) pixel += count; if (pixel >= count) pixel -= count;
-
-float waveValueForTime(float ledCount, float time, float duration, int initialPixel) {
-    float numberOfWaves = 2;
-    float A = ledCount / 2.0;
-    float x = time;
-    float totalTime = duration;
-    float waveLength = totalTime / numberOfWaves;
-    float k = (2*M_PI)/waveLength;
-    //    float a = (numberOfWaves/totalTime)*1.8;  // a is the rate of decay
-    
-    //    float y = A * exp(-a*x) *sin(k*x) + A;
-    
-    // direct fade with negative sloping line; linear drop off
-    // y = (m*x+b)*sin(k*x)+A
-    
-    float b = ledCount / 2.0; // A
-    float m = -b/totalTime;
-    float y = (m*x+b)*sin(k*x)+A;
-    
-    // Offset randomly each iteration
-    y = round(y); // round..floor, what should i do?
-    
-    //    y += initialPixel;
-    //    if (y >= ledCount) {
-    //        // wrap
-    //        y -= ledCount;
-    //    }
-    return y;
-}
-
-void LEDPatterns::wavePatternWithColor(CRGB c, int initialPixel) {
-    int mainPixel = waveValueForTime(m_ledCount, m_timePassed, m_duration, initialPixel);
-    // consider the offset
-    int tmp = mainPixel + initialPixel;
-    WRAP_AROUND(tmp, m_ledCount);
-    
-    setPixelColor(tmp/*mainPixel*/, c);
-    
-    // Calculate the time a bit ago
-    float step = m_duration * .043; // x% ago -- this determines the "tail length" 0.04 is good
-    float timePassed = m_timePassed - step;
-    if (timePassed < 0) {
-        timePassed = 0;
-    }
-    
-    int pixel = waveValueForTime(m_ledCount, timePassed, m_duration, initialPixel);
-    float pixelsToFadeOver = mainPixel - pixel;
-    // fade to that one..
-    if (pixelsToFadeOver != 0) {
-        // going up
-        while (pixel != mainPixel) {
-            float dist = mainPixel - pixel;
-            float intensity = 1 - (dist / pixelsToFadeOver);
-            // TODO: this could be made much faster and more effecient by using the CRGB stuff
-            CRGB tmpColor = c;
-            tmpColor.r *= intensity;
-            tmpColor.g *= intensity;
-            tmpColor.b *= intensity;
-            
-            int tmp = pixel + initialPixel;
-            WRAP_AROUND(tmp, m_ledCount);
-            
-            setPixelColor(tmp /*pixel*/, tmpColor);
-            if (pixel < mainPixel) {
-                pixel++;
-            } else {
-                pixel--;
-            }
-        }
+// Where the waves are for a phase through the pattern (16.16 of the duration): it swings twice around the middle of the strip, dying out linearly to the end. Returns 16.16 pixels.
+static int32_t waveValueForPhase(uint32_t ledCount, uint32_t phase) {
+    if (phase > 65536) {
+        phase = 65536;
     }
+    // (ledCount/2) * (1 - phase) * sin(2 waves * 2pi * phase) + ledCount/2
+    int32_t s = sin16((uint16_t)(phase * 2));
+    return (int32_t)(ledCount << 15) + (int32_t)(((int64_t)ledCount * (65536 - phase) * s) >> 16);
 }
 
+// Each wave's own state; they are in temp buffer 1, so snapshots have them
+typedef struct {
+    uint16_t origin;
+    CRGB color;
+} LEDWave;
+
+#define WAVE_DEFAULT_COUNT 4
+#define WAVE_MAX_COUNT 16
+// How far back the tail goes; 0.043 of the duration
+#define WAVE_TAIL_PHASE 2818
+
 void LEDPatterns::wavePattern() {
+    LEDWave *waves = (LEDWave *)getTempBuffer1();
+    if (waves == NULL || m_ledCount == 0) {
+        return;
+    }
     // Reset on 0 time..
     if (m_firstTime) {
-        m_initialPixel = random(m_ledCount);
-        
-        float inc = m_ledCount / 4.0;
-        
-        m_initialPixel1 = m_initialPixel + inc;
-        while (m_initialPixel1 > m_ledCount) m_initialPixel1 -= m_ledCount;
-        
-        m_initialPixel2 = m_initialPixel1 + inc;
-        while (m_initialPixel2 > m_ledCount) m_initialPixel2 -= m_ledCount;
-        
-        m_initialPixel3 = m_initialPixel2 + inc;
-        while (m_initialPixel3 > m_ledCount) m_initialPixel3 -= m_ledCount;
-        //        initialPixel1 = random(m_ledCount);
-        //        initialPixel2 = random(m_ledCount);
-        //        initialPixel3 = random(m_ledCount);
-        
-        //        randColor1 = (uint8_t)random(255) << 16 | (uint8_t)random(255) << 8 | (uint8_t)random(255); //        0xFF0000; // red
-        //        randColor2 = (uint8_t)random(255) << 16 | (uint8_t)random(255) << 8 | (uint8_t)random(255); //        0xFF0000; // red
-        //        randColor3 = (uint8_t)random(255) << 16 | (uint8_t)random(255) << 8 | (uint8_t)random(255); //        0xFF0000; // red
-        CHSV hsv;
-        if (m_stateInfoCount > 0) {
-            // replace the original color
-            hsv = CHSV(random(HUE_MAX_RAINBOW), 255, 255);
-            hsv2rgb_rainbow(hsv, m_patternColor);
-
-            int inc = HUE_MAX_RAINBOW / 4;
-            
-            hsv.hue += inc; // Wraps
-            hsv2rgb_rainbow(hsv, m_randColor1);
-
-            hsv.hue += inc; // Wraps
-            hsv2rgb_rainbow(hsv, m_randColor2);
-
-            hsv.hue += inc; // Wraps
-            hsv2rgb_rainbow(hsv, m_randColor3);
-        } else {
-            m_randColor1 = m_randColor2 = m_randColor3 = m_patternColor;
+        int waveCount = m_patternOptions.waveOptions.waveCount;
+        if (waveCount == 0) {
+            waveCount = WAVE_DEFAULT_COUNT;
+        }
+        waveCount = min(waveCount, WAVE_MAX_COUNT);
+        waveCount = min(waveCount, (int)(getBufferSize() / sizeof(LEDWave)));
+        // Only this many waves were set up; the options may change while it runs
+        m_initialPixel = waveCount;
+        uint32_t origin = m_random.random(m_ledCount);
+        const CRGB *rainbow = LEDRainbow::GetColors();
+        uint8_t hue = m_random.random(HUE_MAX_RAINBOW);
+        for (int w = 0; w < waveCount; w++) {
+            if (m_patternOptions.waveOptions.randomOrigins) {
+                waves[w].origin = m_random.random(m_ledCount);
+            } else {
+                waves[w].origin = (origin + (w * m_ledCount) / waveCount) % m_ledCount;
+            }
+            // The first time they are all the pattern color; after that, evenly spaced around the wheel
+            if (m_stateInfoCount > 0) {
+                waves[w].color = rainbow[(uint8_t)(hue + (w * 256) / waveCount)];
+            } else {
+                waves[w].color = m_patternColor;
+            }
         }
         // inc the m_stateInfoCount each "first time" to keep track of each reset and reset the color on each "first time"
         m_stateInfoCount++;
     }
+    int waveCount = m_initialPixel;
+    
+    // All the waves are the same shape from a different origin, so where the head and tail are is only worked out once
+    uint32_t phase = m_duration > 0 ? ((uint64_t)m_timePassed << 16) / m_duration : 65536;
+    uint32_t tailPhase = phase > WAVE_TAIL_PHASE ? phase - WAVE_TAIL_PHASE : 0;
+    int mainPixel = (waveValueForPhase(m_ledCount, phase) + 0x8000) >> 16;
+    int tailPixel = (waveValueForPhase(m_ledCount, tailPhase) + 0x8000) >> 16;
+    int tailLength = abs(mainPixel - tailPixel);
+    int direction = mainPixel > tailPixel ? 1 : -1;
+    // the tail goes from off at its end up to the head; 8.8
+    uint16_t levelStep = tailLength > 0 ? 65536 / tailLength : 0;
     
     // reset to black
     fill_solid(m_leds, m_ledCount, CRGB::Black);
     
-    wavePatternWithColor(m_patternColor, m_initialPixel);
-    wavePatternWithColor(m_randColor1, m_initialPixel1);
-    wavePatternWithColor(m_randColor2, m_initialPixel2);
-    wavePatternWithColor(m_randColor3, m_initialPixel3);
+    for (int w = 0; w < waveCount; w++) {
+        int pixel = mainPixel + waves[w].origin;
+        while (pixel >= (int)m_ledCount) pixel -= m_ledCount;
+        m_leds[pixel] = waves[w].color;
+        
+        pixel = tailPixel + waves[w].origin;
+        while (pixel >= (int)m_ledCount) pixel -= m_ledCount;
+        uint16_t level = 0;
+        for (int i = 0; i < tailLength; i++) {
+            CRGB c = waves[w].color;
+            c.nscale8(level >> 8);
+            m_leds[pixel] = c;
+            level += levelStep;
+            pixel += direction;
+            if (pixel < 0) {
+                pixel += m_ledCount;
+            } else if (pixel >= (int)m_ledCount) {
+                pixel -= m_ledCount;
+            }
+        }
+    }
 }
 
-
-void LEDPatterns::bottomGlowFromTopPixel(float topPixel) {
-    // 60 degress of fading in and out
-    int fadeCount = (float)m_ledCount * (60.0/360.0);
-    // x degress of full on
-    int fullCount = (float)m_ledCount * (90.0/360.0);
-    // What is left is black
-    int offCount = m_ledCount - fullCount - 2*fadeCount;
-    // Start past the off count
-    int halfOffCount = floor((float)offCount / 2.0);
-    
-    int wholeTopPixel = floor(topPixel);
-    //    float fractionalToTheNextPixel = topPixel - (float)wholeTopPixel;
-    
-    int pixel = wholeTopPixel + halfOffCount;
-    
-    // Fade on
-    for (int i = 0; i < fadeCount; i++) {
-        WRAP_AROUND(pixel, m_ledCount);
-        float percentage = (float)(i + 1) / (float)fadeCount;
-        CRGB c = m_patternColor;
-        c.red *= percentage;
-        c.green *= percentage;
-        c.blue *= percentage;
-        setPixelColor(pixel, c);
-        pixel++;
-    }
-    
-    // Full on
-    for (int i = 0; i < fullCount; i++) {
-        WRAP_AROUND(pixel, m_ledCount);
-        setPixelColor(pixel, m_patternColor);
-        pixel++;
-    }
-    
-    // Fade off
-    for (int i = 0; i < fadeCount; i++) {
-        WRAP_AROUND(pixel, m_ledCount);
-        float percentage = 1.0 - ((float)i / (float)fadeCount);
-        CRGB c = m_patternColor;
-        c.red *= percentage;
-        c.green *= percentage;
-        c.blue *= percentage;;
-        setPixelColor(pixel, c);
-        pixel++;
+// The glow is centered opposite topAngle: 150 degrees off at the top, 60 degrees of fading in, 90 degrees of full on and 60 degrees of fading out
+void LEDPatterns::bottomGlowFromTopAngle(uint16_t topAngle) {
+    LEDGeometry *geometry = getGeometry();
+    if (geometry == NULL) {
+        return;
     }
+    const uint16_t fadeOnStart = LED_ANGLE_FROM_DEGREES(75);
+    const uint16_t fullStart = LED_ANGLE_FROM_DEGREES(75 + 60);
+    const uint16_t fullEnd = LED_ANGLE_FROM_DEGREES(75 + 60 + 90);
+    const uint16_t fadeOffEnd = LED_ANGLE_FROM_DEGREES(75 + 60 + 90 + 60);
+    // 0..256 over the fade, in 16.16
+    const uint32_t fadeScale = (256UL << 16) / (fullStart - fadeOnStart);
     
-    // off top portion
-    for (int i = 0; i < offCount; i++) {
-        WRAP_AROUND(pixel, m_ledCount);
-        setPixelColor(pixel, CRGB::Black);
-        pixel++;
+    const uint16_t *angles = geometry->getAngles();
+    for (int i = 0; i < m_ledCount; i++) {
+        uint16_t angle = angles[i] - topAngle; // relative to the top; wraps on its own
+        if (angle < fadeOnStart || angle >= fadeOffEnd) {
+            m_leds[i] = CRGB::Black;
+        } else if (angle >= fullStart && angle < fullEnd) {
+            m_leds[i] = m_patternColor;
+        } else {
+            uint32_t amount;
+            if (angle < fullStart) {
+                amount = ((uint32_t)(angle - fadeOnStart) * fadeScale) >> 16;
+            } else {
+                amount = ((uint32_t)(fadeOffEnd - angle) * fadeScale) >> 16;
+            }
+            CRGB c = m_patternColor;
+            c.red = (c.red * amount) >> 8;
+            c.green = (c.green * amount) >> 8;
+            c.blue = (c.blue * amount) >> 8;
+            m_leds[i] = c;
+        }
     }
-    
 }
 
 void LEDPatterns::bottomGlow() {
     // Set once, and done. A cheap pattern.
     if (m_firstTime) {
-        bottomGlowFromTopPixel(0); // glow from pixel 0..
+        bottomGlowFromTopAngle(0); // glow from the top..
     } else {
         m_needsInternalShow = false;
     }
@@ -1819,62 +2026,128 @@ bool LEDPatterns::shouldUpdatePattern() {
 // Default 120, suggested range 50-200.
 #define SPARKING 130
 
+// The fire works on 4 cells at a time in a uint32_t
+
+// Saturating subtract of each byte
+static inline uint32_t qsub8x4(uint32_t a, uint32_t b) {
+#if defined(__ARM_FEATURE_SIMD32)
+    uint32_t result;
+    asm ("uqsub8 %0, %1, %2" : "=r" (result) : "r" (a), "r" (b));
+    return result;
+#else
+    // Two bytes at a time in 16-bit lanes; bit 8 of a lane is still set if it didn't go under
+    uint32_t even = ((a & 0x00FF00FF) | 0x01000100) - (b & 0x00FF00FF);
+    uint32_t odd = (((a >> 8) & 0x00FF00FF) | 0x01000100) - ((b >> 8) & 0x00FF00FF);
+    even &= ((even >> 8) & 0x00010001) * 0xFF;
+    odd &= ((odd >> 8) & 0x00010001) * 0xFF;
+    return even | (odd << 8);
+#endif
+}
+
+// x / 3 for x up to 765 (the most below1 + 2*below2 can be), exactly
+#define DIV3_765(x) (((x)*85 + ((x) >> 2) + 85) >> 8)
+
+// (below1 + 2*below2) / 3 for each byte, in 16-bit lanes. It is DIV3_765 in each lane, which can't overflow one (765*85 + 191 + 85 < 65536).
+static inline uint32_t diffuse8x4(uint32_t below1, uint32_t below2) {
+    uint32_t even = (below1 & 0x00FF00FF) + ((below2 & 0x00FF00FF) << 1);
+    uint32_t odd = ((below1 >> 8) & 0x00FF00FF) + (((below2 >> 8) & 0x00FF00FF) << 1);
+    even = (even * 85 + ((even >> 2) & 0x00FF00FF) + 0x00550055) >> 8;
+    odd = odd * 85 + ((odd >> 2) & 0x00FF00FF) + 0x00550055;
+    return (even & 0x00FF00FF) | (odd & 0xFF00FF00);
+}
+
+static inline uint32_t loadHeat(const uint8_t *cells) {
+    uint32_t result;
+    memcpy(&result, cells, 4); // may not be aligned
+    return result;
+}
+
+static inline void storeHeat(uint8_t *cells, uint32_t value) {
+    memcpy(cells, &value, 4);
+}
+
+// Cools 4 cells by a random amount each, from 0 to range-1 (range is at most 256)
+static inline void coolHeat(uint8_t *cells, LEDRandom *random, uint32_t range) {
+    uint32_t r = random->next();
+    uint32_t even = (((r & 0x00FF00FF) * range) >> 8) & 0x00FF00FF;
+    uint32_t odd = (((r >> 8) & 0x00FF00FF) * range) & 0xFF00FF00;
+    storeHeat(cells, qsub8x4(loadHeat(cells), even | odd));
+}
+
+// The flames are in temp buffer 1 as one array of heat. Flame f has the LEDs from f*count/flameCount up to (f+1)*count/flameCount, and a row of cells for them, from the base up, padded to a multiple of 4 so the rows can be done 4 cells at a time. Even flames go forward from the start of their part of the strip, and odd ones go backwards from the end of theirs, so with the default of 2 there is one flame on each half that meet in the middle.
 void LEDPatterns::fireColorWithPalette(const CRGBPalette16& pal, int cooling, int sparking) {
     if (!shouldUpdatePattern()) {
         return;
     }
-    // Array of temperature readings at each simulation cell
-    byte *heat = (byte *)getTempBuffer1();
-    byte *heat2 = (byte *)getTempBuffer2();
+    int flameCount = m_patternOptions.fireOptions.flameCount;
+    if (flameCount == 0) {
+        flameCount = 2;
+    }
+    if (flameCount > (int)m_ledCount) {
+        flameCount = m_ledCount > 0 ? m_ledCount : 1;
+    }
+    int cellCount = (m_ledCount + flameCount - 1) / flameCount; // the longest flame
+    int rowSize = (cellCount + 3) & ~3;
+    uint8_t *heat = (uint8_t *)getTempBuffer1();
+    if (heat == NULL || flameCount * rowSize > getBufferSize()) {
+        return; // only tiny strips
+    }
     
     if (m_firstTime) {
-        for (int i = 0; i < m_ledCount; i++) {
-            heat[i] = 0; // random8(255);
-            heat2[i] = 0;
-        }
+        bzero(heat, flameCount * rowSize);
     }
     
-    int count = m_ledCount / 2;
-    int secondHalfCount = m_ledCount - count;
-    if (secondHalfCount > count) {
-        count = secondHalfCount;
+    const CRGB *colors = m_paletteCache.getColors(pal);
+    if (colors == NULL) {
+        return;
     }
     
-    // Step 1.  Cool down every cell a little
-    for( int i = 0; i < count; i++) {
-        heat[i] = qsub8( heat[i],  random(0, ((cooling * 10) / count) + 2));
-        heat2[i] = qsub8( heat2[i],  random(0, ((cooling * 10) / count) + 2));
+    uint32_t coolRange = ((cooling * 10) / cellCount) + 2;
+    if (coolRange > 256) {
+        coolRange = 256;
     }
     
-    // Step 2.  Heat from each cell drifts 'up' and diffuses a little
-    for( int k= count - 1; k >= 2; k--) {
-        heat[k] = (heat[k - 1] + heat[k - 2] + heat[k - 2] ) / 3;
-        heat2[k] = (heat2[k - 1] + heat2[k - 2] + heat2[k - 2] ) / 3;
+    for (int f = 0; f < flameCount; f++) {
+        uint8_t *row = heat + f * rowSize;
+        // Step 1 and 2.  Cool down every cell a little, and heat from each cell drifts 'up' and diffuses a little. Done from the top down in one pass; each group of 4 is cooled right before the diffusion reads it.
+        coolHeat(row + rowSize - 4, &m_random, coolRange);
+        for (int k = rowSize - 4; k >= 4; k -= 4) {
+            coolHeat(row + k - 4, &m_random, coolRange);
+            storeHeat(row + k, diffuse8x4(loadHeat(row + k - 1), loadHeat(row + k - 2)));
+        }
+        // The first 4; the bottom two only cool
+        row[3] = DIV3_765(row[2] + row[1] + row[1]);
+        row[2] = DIV3_765(row[1] + row[0] + row[0]);
     }
-//    for( int k= NUM_LEDS - 1; k >= 2; k--) {
-//        heat[k] = (heat[k - 1] + heat[k - 2] + heat[k - 2] ) / 3;
-//    }
     
     // Step 3.  Randomly ignite new 'sparks' of heat near the bottom
-    if( random(255) < sparking ) {
-        int y = random(7);
-        heat[y] = qadd8( heat[y], random(160,255) );
-        y = random(7);
-        heat2[y] = qadd8( heat2[y], random(160,255) );
-    }
-    
-    // Step 4.  Map from heat cells to LED colors
-    int k = m_ledCount - 1;
-    for( int j = 0; j < count; j++) {
-        byte colorindex = scale8( heat[j], 240);
-        m_leds[j] = ColorFromPalette(pal, colorindex);
-        
-        byte colorindex2 = scale8( heat2[j], 240);
-        m_leds[k] = ColorFromPalette(pal, colorindex2);
-        k--;
-    }
-}
-
+    if( m_random.random(255) < sparking ) {
+        for (int f = 0; f < flameCount; f++) {
+            uint8_t *row = heat + f * rowSize;
+            int length = ((f + 1) * (int)m_ledCount) / flameCount - (f * (int)m_ledCount) / flameCount;
+            int y = m_random.random(min(7, length));
+            row[y] = qadd8( row[y], m_random.random(160,255) );
+        }
+    }
+    
+    // Step 4.  Map from heat cells to LED colors; the top of the palette is left off (scale8 by 240)
+    for (int f = 0; f < flameCount; f++) {
+        const uint8_t *row = heat + f * rowSize;
+        int start = (f * (int)m_ledCount) / flameCount;
+        int end = ((f + 1) * (int)m_ledCount) / flameCount;
+        if (f & 1) {
+            // backwards from the end of its part
+            for (int c = 0; c < end - start; c++) {
+                m_leds[end - 1 - c] = colors[scale8(row[c], 240)];
+            }
+        } else {
+            for (int c = 0; c < end - start; c++) {
+                m_leds[start + c] = colors[scale8(row[c], 240)];
+            }
+        }
+    }
+}
+
 void LEDPatterns::firePatternWithColor(bool blue) {
 
     if (blue) {
@@ -1895,7 +2168,49 @@ void LEDPatterns::blueFirePattern() {
     firePatternWithColor(true);
 }
 
-void LEDPatterns::crossFadeToNextPattern() {
+void LEDPatterns::audioFirePattern() {
+    // The bass drives the sparking, and a beat always sparks
+    int sparking = SPARKING;
+    LEDAudioAnalyzer *audio = getAudio();
+    if (audio) {
+        sparking = audio->isBeat() ? 255 : 40 + scale8(max(audio->getBand(0), audio->getBand(1)), 200);
+    }
+    fireColorWithPalette(HeatColors_p, COOLING, sparking);
+}
+
+void LEDPatterns::audioSpectrumPattern() {
+    // Each band gets an equal part of the strip and lights up from its start as high as the band is; the bands go around the rainbow
+    fill_solid(m_leds, m_ledCount, CRGB::Black);
+    LEDAudioAnalyzer *audio = getAudio();
+    if (audio == NULL) {
+        return;
+    }
+    const uint8_t *bands = audio->getBands();
+    const CRGB *rainbow = LEDRainbow::GetColors();
+    for (int b = 0; b < LED_AUDIO_BAND_COUNT; b++) {
+        int start = (b * m_ledCount) / LED_AUDIO_BAND_COUNT;
+        int end = ((b + 1) * m_ledCount) / LED_AUDIO_BAND_COUNT;
+        // in 8.8 so the top pixel can be partly on
+        uint32_t height = (uint32_t)(end - start) * bands[b];
+        int fullCount = height >> 8;
+        CRGB color = rainbow[b * (256 / LED_AUDIO_BAND_COUNT)];
+        fill_solid(&m_leds[start], fullCount, color);
+        if (start + fullCount < end) {
+            m_leds[start + fullCount] = color;
+            m_leds[start + fullCount].nscale8(height & 0xFF);
+        }
+    }
+}
+
+void LEDPatterns::audioBeatPulsePattern() {
+    LEDAudioAnalyzer *audio = getAudio();
+    uint8_t level = audio ? audio->getBeatLevel() : 0;
+    CRGB color = m_patternColor;
+    color.nscale8_video(level);
+    fill_solid(m_leds, m_ledCount, color);
+}
+
+void LEDPatterns::transitionToNextPattern() {
     CRGB *startingBuffer = getTempBuffer1();
     CRGB *endingBuffer = getTempBuffer2();
     
@@ -1904,25 +2219,211 @@ void LEDPatterns::crossFadeToNextPattern() {
         // First pass, store off the initial state..
         memcpy(startingBuffer, m_leds, getBufferSize());
         
-        // Run one tick of the next pattern...This won't work if the next pattern is another crossfade..
-        if (m_nextPatternType != LEDPatternTypeCrossfade) {
+        // Run one tick of the next pattern...This won't work if the next pattern is another transition..
+        if (!PatternIsTransition(m_nextPatternType)) {
+            // with its own color and options
+            CRGB patternColor = m_patternColor;
+            LEDPatternOptions patternOptions = m_patternOptions;
+            if (m_hasNextPatternColor) {
+                m_patternColor = m_nextPatternColor;
+            }
+            m_patternOptions = m_nextPatternOptions;
             updateLEDsForPatternType(m_nextPatternType);
+            m_patternColor = patternColor;
+            m_patternOptions = patternOptions;
         }
 
         // Then do the same for the dest buffer
         memcpy(endingBuffer, m_leds, getBufferSize());
     }
-    // Now smoothly crossfade the alpha of one to the other over our duration
+    // Now smoothly go from one to the other over our duration
     float percentage = getPercentagePassed();
-    int alpha = 255 - percentage*255; // value from 0-255
-    alpha++; // Value from 1-256, so we can shift instead of multiply or divide
-    int inverse = 257 - alpha; // value for the fade in
+    if (percentage > 1.0) {
+        percentage = 1.0;
+    }
+    composeTransition(startingBuffer, endingBuffer, round(percentage*256));
+}
 
-    for (int i= 0; i < m_ledCount; i++) {
-        m_leds[i].red = (startingBuffer[i].red * alpha + endingBuffer[i].red*inverse) >> 8;
-        m_leds[i].green = (startingBuffer[i].green * alpha + endingBuffer[i].green*inverse) >> 8;
-        m_leds[i].blue = (startingBuffer[i].blue * alpha + endingBuffer[i].blue*inverse) >> 8;
+// Thresholds are spread evenly over 0-255 so the same fraction of pixels has switched as the amount that has passed
+uint8_t *LEDPatterns::getTransitionMap(LEDPatternType transitionType) {
+    if (m_transitionMap == NULL) {
+        m_transitionMap = (uint8_t *)malloc(m_ledCount);
+        if (m_transitionMap == NULL) {
+            return NULL;
+        }
+        m_transitionMapType = LEDPatternTypeCount;
+    }
+    if (m_transitionMapType != transitionType) {
+        uint8_t *map = m_transitionMap;
+        switch (transitionType) {
+            case LEDPatternTypeIrisTransition: {
+                // Distance from the center, in half pixels so odd and even counts are both symmetric
+                int lastPixel = m_ledCount - 1;
+                for (int i = 0; i < m_ledCount; i++) {
+                    int distance = abs(2*i - lastPixel);
+                    map[i] = (distance * 256) / (lastPixel + 2);
+                }
+                break;
+            }
+            case LEDPatternTypeDissolveTransition: {
+                // A random permutation of evenly spread thresholds (Fisher-Yates)
+                for (int i = 0; i < m_ledCount; i++) {
+                    map[i] = (i * 256) / m_ledCount;
+                }
+                for (int i = m_ledCount - 1; i > 0; i--) {
+                    int j = m_random.random(i + 1);
+                    uint8_t tmp = map[i];
+                    map[i] = map[j];
+                    map[j] = tmp;
+                }
+                break;
+            }
+            case LEDPatternTypeWipeTransition:
+            default: {
+                for (int i = 0; i < m_ledCount; i++) {
+                    map[i] = (i * 256) / m_ledCount;
+                }
+                break;
+            }
+        }
+        m_transitionMapType = transitionType;
     }
+    return m_transitionMap;
+}
+
+void LEDPatterns::composeTransition(const CRGB *from, const CRGB *to, uint16_t amount) {
+    uint8_t *map = m_patternType == LEDPatternTypeCrossfade ? NULL : getTransitionMap(m_patternType);
+    if (map == NULL) {
+        if (m_patternOptions.crossfadeOptions.linearLight) {
+            LEDBlend::BlendLinear(m_leds, from, to, m_ledCount, amount);
+        } else {
+            LEDBlend::Blend(m_leds, from, to, m_ledCount, amount);
+        }
+    } else {
+        // One compare and select per pixel
+        for (int i = 0; i < m_ledCount; i++) {
+            m_leds[i] = map[i] < amount ? to[i] : from[i];
+        }
+    }
+}
+
+// Brings back a pattern from its slot, runs one tick of it with its own timing, and saves it back
+void LEDPatterns::renderTransitionSlot(uint8_t *blob, uint32_t now) {
+    _restoreState(blob, m_transitionSlotSize, true);
+    if (!PatternIsTransition(m_patternType)) {
+        _updatePatternFromTime(now);
+    }
+    snapshotState(blob, m_transitionSlotSize);
+}
+
+void LEDPatterns::liveTransitionToNextPattern() {
+    if (!m_transitionOutgoingValid) {
+        // Nothing was live when the transition started (or it didn't fit); go from the still frame
+        transitionToNextPattern();
+        return;
+    }
+    // Rendering the two sides replaces the pattern state, so stash the transition's own
+    LEDPatternType transitionType = m_patternType;
+    LEDPatternType nextPatternType = m_nextPatternType;
+    uint32_t startTime = m_startTime;
+    uint32_t duration = m_duration;
+    uint32_t timePassed = m_timePassed;
+    bool firstTime = m_firstTime;
+    float percentagePassed = m_percentagePassedCache;
+    CRGB patternColor = m_patternColor;
+    LEDPatternOptions patternOptions = m_patternOptions;
+    uint32_t now = m_frameTime;
+    
+#if SD_CARD_SUPPORT
+    CDPatternBitmap *incomingBitmap = m_lazyBitmap;
+    if (m_transitionOutgoingBitmap) {
+        m_lazyBitmap = m_transitionOutgoingBitmap;
+    }
+    renderTransitionSlot(m_transitionOutgoing, now);
+    m_lazyBitmap = incomingBitmap;
+#else
+    renderTransitionSlot(m_transitionOutgoing, now);
+#endif
+    
+    if (m_transitionIncomingValid) {
+        renderTransitionSlot(m_transitionIncoming, now);
+    } else if (!PatternIsTransition(nextPatternType)) {
+        // Start the next pattern on top of the outgoing frame, just like it would if it were switched to directly
+        m_patternType = nextPatternType;
+        m_startTime = now;
+        m_firstTime = true;
+        m_stateInfoCount = 0;
+        m_loopCount = 0;
+        m_count = 0;
+        m_duration = m_nextPatternDuration != 0 ? m_nextPatternDuration : duration;
+        m_patternColor = m_hasNextPatternColor ? m_nextPatternColor : patternColor;
+        m_patternOptions = m_nextPatternOptions;
+        _updatePatternFromTime(now);
+        m_transitionIncomingValid = snapshotState(m_transitionIncoming, m_transitionSlotSize) != 0;
+    }
+    
+    m_patternType = transitionType;
+    m_nextPatternType = nextPatternType;
+    m_startTime = startTime;
+    m_duration = duration;
+    m_timePassed = timePassed;
+    m_firstTime = firstTime;
+    m_percentagePassedCache = percentagePassed;
+    m_patternColor = patternColor;
+    m_patternOptions = patternOptions;
+    m_needsInternalShow = true; // the sides may have turned it off
+    
+    CRGB *from = _SnapshotLEDs(m_transitionOutgoing);
+    if (m_transitionIncomingValid) {
+        float percentage = percentagePassed > 1.0 ? 1.0 : percentagePassed;
+        composeTransition(from, _SnapshotLEDs(m_transitionIncoming), round(percentage*256));
+    } else {
+        memcpy(m_leds, from, getBufferSize());
+    }
+}
+
+bool LEDPatterns::allocateTransitionPool() {
+    if (m_transitionOutgoing) {
+        return true;
+    }
+    m_transitionSlotSize = getMaxStateSnapshotSize();
+    m_transitionOutgoing = (uint8_t *)malloc(m_transitionSlotSize);
+    m_transitionIncoming = (uint8_t *)malloc(m_transitionSlotSize);
+    if (m_transitionOutgoing == NULL || m_transitionIncoming == NULL) {
+        DEBUG_PRINTLN("not enough RAM for the transition pool");
+        freeTransitionPool();
+        return false;
+    }
+    if (m_transitionMap == NULL) {
+        m_transitionMap = (uint8_t *)malloc(m_ledCount);
+    }
+    // Both sides may use the temp buffers; have them around up front so a transition doesn't allocate them
+    getTempBuffer1();
+    getTempBuffer2();
+    // Same for the particles; a pattern using them already has the pool at its full size
+    if (!PatternUsesParticles(m_patternType) && m_particles.getCapacity() < getMaxParticleCount()) {
+        m_particles.allocate(getMaxParticleCount());
+    }
+    m_transitionOutgoingValid = false;
+    m_transitionIncomingValid = false;
+    return true;
+}
+
+void LEDPatterns::freeTransitionPool() {
+    if (m_transitionOutgoing) {
+        free(m_transitionOutgoing);
+        m_transitionOutgoing = NULL;
+    }
+    if (m_transitionIncoming) {
+        free(m_transitionIncoming);
+        m_transitionIncoming = NULL;
+    }
+    m_transitionSlotSize = 0;
+    m_transitionOutgoingValid = false;
+    m_transitionIncomingValid = false;
+#if SD_CARD_SUPPORT
+    releaseTransitionOutgoingBitmap();
+#endif
 }
 
 
@@ -1947,9 +2448,8 @@ byte sineTable[181]  = {
     127,127,127,127,127
 };
 
-char fixSin(int angle) {
-    angle %= 720;               // -719 to +719
-    if(angle < 0) angle += 720; //    0 to +719
+// For an angle that is already 0 to +719
+static inline char fixSinInRange(int angle) {
     return (angle <= 360) ?
         sineTable[(angle <= 180) ?
                              angle          : // Quadrant 1
@@ -1959,9 +2459,14 @@ char fixSin(int angle) {
                               (720 - angle)] ; // Quadrant 4
 }
 
-char fixCos(int angle) {
+char fixSin(int angle) {
     angle %= 720;               // -719 to +719
     if(angle < 0) angle += 720; //    0 to +719
+    return fixSinInRange(angle);
+}
+
+// For an angle that is already 0 to +719
+static inline char fixCosInRange(int angle) {
     return (angle <= 360) ?
         ((angle <= 180) ?  (sineTable[180 - angle])  : // Quad 1
          -(sineTable[angle - 180])) : // Quad 2
@@ -1969,6 +2474,12 @@ char fixCos(int angle) {
          (sineTable[angle - 540])) ; // Quad 4
 }
 
+char fixCos(int angle) {
+    angle %= 720;               // -719 to +719
+    if(angle < 0) angle += 720; //    0 to +719
+    return fixCosInRange(angle);
+}
+
 
 /*static double threeway_max(double a, double b, double c) {
     return MAX(a, MAX(b, c));
@@ -2008,6 +2519,61 @@ static CHSV rgb2hsv(CRGB in)
 }
 */
 
+// Data for American-flag-like colors (20 pixels representing
+// blue field, stars and stripes).  This gets "stretched" as needed
+// to the full LED strip length in the flag effect code, below.
+// Use setFlagColors for the colors of your own national flag,
+// favorite sports team colors, etc.
+#define C_RED    CRGB(160,   0,   0)
+#define C_WHITE CRGB::White
+#define C_BLUE  CRGB(0,   0, 100)
+static const CRGB g_defaultFlagColors[]  = {
+    C_BLUE , C_WHITE, C_BLUE , C_WHITE, C_BLUE , C_WHITE, C_BLUE, C_WHITE, C_BLUE, C_WHITE, C_BLUE,
+    C_RED  , C_WHITE, C_RED  , C_WHITE, C_RED  , C_WHITE, C_RED , C_WHITE, C_RED ,
+    C_WHITE, C_RED  , C_WHITE, C_RED  , C_WHITE, C_RED, C_WHITE, C_RED };
+
+// Replaces a malloc'd copy of some colors; NULL or 0 colors frees it
+static bool copyColors(CRGB **result, uint8_t *resultCount, const CRGB *colors, uint8_t count) {
+    if (*result) {
+        free(*result);
+        *result = NULL;
+        *resultCount = 0;
+    }
+    if (colors == NULL || count == 0) {
+        return true; // back to the default
+    }
+    *result = (CRGB *)malloc(sizeof(CRGB) * count);
+    if (*result == NULL) {
+        return false;
+    }
+    memcpy(*result, colors, sizeof(CRGB) * count);
+    *resultCount = count;
+    return true;
+}
+
+bool LEDPatterns::setFlagColors(const CRGB *colors, uint8_t count) {
+    return copyColors(&m_flagColors, &m_flagColorCount, colors, count);
+}
+
+bool LEDPatterns::setChaseColors(const CRGB *colors, uint8_t count) {
+    return copyColors(&m_chaseColors, &m_chaseColorCount, colors, count);
+}
+
+bool LEDPatterns::setFlagColors(const CRGBPalette16 &palette) {
+    return setFlagColors(palette.entries, 16);
+}
+
+#if SD_CARD_SUPPORT
+bool LEDPatterns::loadFlagColors(const char *filename) {
+    CDPatternBitmap bitmap(filename, getTempBuffer1(), getTempBuffer2(), getBufferSize());
+    if (!bitmap.getIsValid() || bitmap.getFirstBuffer() == NULL) {
+        DEBUG_PRINTLN("couldn't load the flag colors");
+        return false;
+    }
+    return setFlagColors(bitmap.getFirstBuffer(), min(bitmap.getWidth(), (uint32_t)255));
+}
+#endif
+
 // https://github.com/adafruit/LPD8806/blob/master/examples/LEDbeltKit_alt/LEDbeltKit_alt.pde
 // renderEffect03
 void LEDPatterns::flagEffect() {
@@ -2015,38 +2581,55 @@ void LEDPatterns::flagEffect() {
         return;
     }
 
-    // Data for American-flag-like colors (20 pixels representing
-    // blue field, stars and stripes).  This gets "stretched" as needed
-    // to the full LED strip length in the flag effect code, below.
-    // Can change this data to the colors of your own national flag,
-    // favorite sports team colors, etc.  OK to change number of elements.
-#define C_RED    CRGB(160,   0,   0)
-#define C_WHITE CRGB::White
-#define C_BLUE  CRGB(0,   0, 100)
-     CRGB flagTable[]  = {
-        C_BLUE , C_WHITE, C_BLUE , C_WHITE, C_BLUE , C_WHITE, C_BLUE, C_WHITE, C_BLUE, C_WHITE, C_BLUE,
-        C_RED  , C_WHITE, C_RED  , C_WHITE, C_RED  , C_WHITE, C_RED , C_WHITE, C_RED ,
-        C_WHITE, C_RED  , C_WHITE, C_RED  , C_WHITE, C_RED, C_WHITE, C_RED };
+    const CRGB *flagTable = m_flagColors ? m_flagColors : g_defaultFlagColors;
+    int flagTableCount = m_flagColors ? m_flagColorCount : sizeof(g_defaultFlagColors) / sizeof(CRGB);
     
     // Wavy flag effect
-    int i, sum, s;
+    int i;
     int  a, b;
     
     if (m_firstTime) {
-        m_initialPixel = 720 + random(720); // Wavyness
-        m_initialPixel1 = 4 + random(10);    // Wave speed
-        m_initialPixel2 = 200 + random(200); // Wave 'puckeryness'
+        m_initialPixel = 720 + m_random.random(720); // Wavyness
+        m_initialPixel1 = 4 + m_random.random(10);    // Wave speed
+        m_initialPixel2 = 200 + m_random.random(200); // Wave 'puckeryness'
         m_initialPixel3 = 0;                 // Current  position
     }
-    for(sum=0, i=0; i<m_ledCount-1; i++) {
-        sum += m_initialPixel2 + fixCos(m_initialPixel3 + m_initialPixel * i / m_ledCount);
-    }
     
+    // How much of the flag each pixel covers: puckeryness + fixCos(position + wavyness * i / m_ledCount). They are worked out once into temp buffer 1, and the angle is stepped along instead of a multiply and divide for each one.
+    uint16_t *terms = (uint16_t *)getTempBuffer1();
+    if (terms == NULL) {
+        return;
+    }
+    int angle = m_initialPixel3;
+    int angleStep = m_initialPixel / m_ledCount;
+    int angleRemainderStep = m_initialPixel % m_ledCount;
+    int angleRemainder = 0;
+    uint32_t sum = 0;
+    for (i = 0; i < m_ledCount; i++) {
+        terms[i] = m_initialPixel2 + fixCosInRange(angle);
+        if (i < m_ledCount - 1) {
+            sum += terms[i]; // the last one isn't in the sum, so the last pixel ends on the last color
+        }
+        angle += angleStep;
+        angleRemainder += angleRemainderStep;
+        if (angleRemainder >= (int)m_ledCount) {
+            angleRemainder -= m_ledCount;
+            angle++;
+        }
+        while (angle >= 720) {
+            angle -= 720;
+        }
+    }
+    if (sum == 0) {
+        sum = 1; // one LED
+    }
     
+    // Where each pixel is in the flag table is the running sum of the terms; the division by the sum is done once, as a 16.16 scale
+    uint32_t scale = ((uint32_t)(256 * (flagTableCount - 1)) << 16) / sum;
+    uint32_t s = 0;
     CRGB *pixel = &m_leds[0];
-    int flagTableCount = (sizeof(flagTable)) / sizeof(CRGB);
-    for(s=0, i=0; i<m_ledCount; i++) {
-        int x = 256L * (flagTableCount - 1) * s / sum;
+    for(i=0; i<m_ledCount; i++) {
+        int x = (s * scale) >> 16;
         int idx1 =  (x >> 8);
         int idx2 = ((x >> 8) + 1);
         if (idx2 >= flagTableCount) {
@@ -2085,8 +2668,7 @@ void LEDPatterns::flagEffect() {
         *pixel = flagTable[idx1];
 #endif
         
-        s += m_initialPixel2 + fixCos(m_initialPixel3 + m_initialPixel *
-                                     i / m_ledCount);
+        s += terms[i];
         pixel++;
     }
     
@@ -2094,29 +2676,14 @@ void LEDPatterns::flagEffect() {
     if (m_initialPixel3 >= 720) m_initialPixel3 -= 720;
 }
 
-// finds the right index for a S shaped matrix
-// ...maybe you need a different mapping for your setup
-int XY(int x, int y, int WIDTH, int HEIGHT) {
-    if(y > HEIGHT) { y = HEIGHT; }
-    if(y < 0) { y = 0; }
-    if(x > WIDTH) { x = WIDTH;}
-    if(x < 0) { x = 0; }
-    if(x % 2 == 1) {
-        return (x * (WIDTH) + (HEIGHT - y -1));
-    } else {
-        // use that line only, if you have all rows beginning at the same side
-        return (x * (WIDTH) + y);
-    }
-}
-
 //  Bresenham line algorythm
-static void Line(int x0, int y0, int x1, int y1, byte color, CRGB *buffer, int WIDTH, int HEIGHT)
+static void Line(int x0, int y0, int x1, int y1, byte color, CRGB *buffer, LEDLayout *layout)
 {
     int dx =  abs(x1-x0), sx = x0<x1 ? 1 : -1;
     int dy = -abs(y1-y0), sy = y0<y1 ? 1 : -1;
     int err = dx+dy, e2;
     for(;;){
-        buffer[XY(x0, y0, WIDTH, HEIGHT)] += CHSV(color, 255, 255);
+        buffer[layout->xy(x0, y0)] += CHSV(color, 255, 255);
         if (x0==x1 && y0==y1) break;
         e2 = 2*err;
         if (e2 > dy) { err += dy; x0 += sx; }
@@ -2125,33 +2692,126 @@ static void Line(int x0, int y0, int x1, int y1, byte color, CRGB *buffer, int W
 }
 
 //  creates a little twister for softening
-void Spiral(int x,int y, int r, byte dimm, CRGB *leds, int WIDTH, int HEIGHT) {
+// The rings can go off the edge, where they stick to it (like the old XY did)
+void Spiral(int x,int y, int r, byte dimm, CRGB *leds, LEDLayout *layout) {
     for(int d = r; d >= 0; d--) {                // from the outside to the inside
         for(int i = x-d; i <= x+d; i++) {
-            leds[XY(i,y-d, WIDTH, HEIGHT)] += leds[XY(i+1,y-d, WIDTH, HEIGHT)];   // lowest row to the right
-            leds[XY(i,y-d, WIDTH, HEIGHT)].nscale8( dimm );}
+            uint16_t index = layout->xyClamped(i,y-d);
+            leds[index] += leds[layout->xyClamped(i+1,y-d)];   // lowest row to the right
+            leds[index].nscale8( dimm );}
         for(int i = y-d; i <= y+d; i++) {
-            leds[XY(x+d,i, WIDTH, HEIGHT)] += leds[XY(x+d,i+1, WIDTH, HEIGHT)];   // right colum up
-            leds[XY(x+d,i, WIDTH, HEIGHT)].nscale8( dimm );}
+            uint16_t index = layout->xyClamped(x+d,i);
+            leds[index] += leds[layout->xyClamped(x+d,i+1)];   // right colum up
+            leds[index].nscale8( dimm );}
         for(int i = x+d; i >= x-d; i--) {
-            leds[XY(i,y+d, WIDTH, HEIGHT)] += leds[XY(i-1,y+d, WIDTH, HEIGHT)];   // upper row to the left
-            leds[XY(i,y+d, WIDTH, HEIGHT)].nscale8( dimm );}
+            uint16_t index = layout->xyClamped(i,y+d);
+            leds[index] += leds[layout->xyClamped(i-1,y+d)];   // upper row to the left
+            leds[index].nscale8( dimm );}
         for(int i = y+d; i >= y-d; i--) {
-            leds[XY(x-d,i, WIDTH, HEIGHT)] += leds[XY(x-d,i-1, WIDTH, HEIGHT)];   // left colum down
-            leds[XY(x-d,i, WIDTH, HEIGHT)].nscale8( dimm );}
+            uint16_t index = layout->xyClamped(x-d,i);
+            leds[index] += leds[layout->xyClamped(x-d,i-1)];   // left colum down
+            leds[index].nscale8( dimm );}
     }
 }
 
-#define NUMBER_LIFE_OBJECTS 0.10 // percentage
-#define NUMBER_BOUNCE_OBJECTS 10
+#define BLUR_MAX_RADIUS 15
+#define BLUR_WINDOW 32 // a power of 2 that holds 2*BLUR_MAX_RADIUS+1 pixels
+
+// The blur used to be amount passes of adding sideWeight/256 of each neighbor to every pixel. This works out what those passes come to as one kernel: weights[0] is for the pixel itself and weights[k] for the pixels k away on each side, 256 being all of it. Returns the radius, leaving off the ends that are too small to matter.
+static int blurWeightsForPasses(int passes, uint8_t sideWeight, uint16_t *weights) {
+    if (passes > BLUR_MAX_RADIUS) {
+        passes = BLUR_MAX_RADIUS;
+    }
+    // Half the kernel, in 16.16 so the small ends don't round away while it is built
+    uint32_t kernel[BLUR_MAX_RADIUS + 2];
+    memset(kernel, 0, sizeof(kernel));
+    kernel[0] = 65536;
+    for (int p = 0; p < passes; p++) {
+        // Convolve with (side, 256, side); going up means kernel[j - 1] is already the new one, so keep the old one
+        uint32_t below = kernel[1]; // it is symmetric, so the one at -1 is the one at 1
+        for (int j = 0; j <= p + 1; j++) {
+            uint32_t old = kernel[j];
+            kernel[j] = old + ((sideWeight * (below + kernel[j + 1])) >> 8);
+            below = old;
+        }
+    }
+    int radius = 0;
+    for (int j = 0; j <= passes; j++) {
+        weights[j] = (kernel[j] + 128) >> 8;
+        if (weights[j] != 0) {
+            radius = j;
+        }
+    }
+    return radius;
+}
 
-void blur(int amount, CRGB *leds, CRGB *temp, int count) {
-    uint8_t t = 10;
-    for (int b = 0; b < amount; b++) {
-        for(int x = 0; x < count; x++) {
-            temp[x] = leds[x] + (leds[(((x-1)%count)+count)%count]%t) + (leds[(x+1)%count]%t);
+// Blurs around the strip (the ends wrap to each other) in place. Only the pixels in the kernel's reach are kept on the side in a small window, and the first radius pixels are saved for the end to wrap to, so there isn't a temp buffer, a copy back, or a modulo for each pixel.
+static void blurWrapped(CRGB *leds, int count, int radius, const uint16_t *weights) {
+    if (radius > BLUR_MAX_RADIUS) {
+        radius = BLUR_MAX_RADIUS;
+    }
+    if (2*radius >= count) {
+        radius = (count - 1) / 2;
+    }
+    if (radius <= 0) {
+        return;
+    }
+    const int mask = BLUR_WINDOW - 1;
+    CRGB head[BLUR_MAX_RADIUS]; // the first ones before they are blurred
+    CRGB window[BLUR_WINDOW]; // the unblurred pixels from x-radius to x+radius; x & mask is where x is
+    memcpy(head, leds, radius*sizeof(CRGB));
+    for (int k = -radius; k < radius; k++) {
+        window[k & mask] = leds[k < 0 ? k + count : k];
+    }
+    for (int x = 0; x < count; x++) {
+        int next = x + radius;
+        window[next & mask] = next < count ? leds[next] : head[next - count];
+        
+        const CRGB &center = window[x & mask];
+        uint32_t r = center.r * weights[0];
+        uint32_t g = center.g * weights[0];
+        uint32_t b = center.b * weights[0];
+        for (int k = 1; k <= radius; k++) {
+            const CRGB &left = window[(x - k) & mask];
+            const CRGB &right = window[(x + k) & mask];
+            r += (left.r + right.r) * weights[k];
+            g += (left.g + right.g) * weights[k];
+            b += (left.b + right.b) * weights[k];
         }
-        memcpy8(leds, temp, sizeof(CRGB)*count); // was sizeof(leds), which is ambiguous..sizeof a pointer???
+        leds[x].r = r > 0xFFFF ? 255 : r >> 8;
+        leds[x].g = g > 0xFFFF ? 255 : g >> 8;
+        leds[x].b = b > 0xFFFF ? 255 : b >> 8;
+    }
+}
+
+// What the old blur(amount) looked like; it added 10/256 of each neighbor amount times
+static void blur(int amount, CRGB *leds, int count) {
+    uint16_t weights[BLUR_MAX_RADIUS + 1];
+    int radius = blurWeightsForPasses(amount, 10, weights);
+    blurWrapped(leds, count, radius, weights);
+}
+
+uint16_t LEDPatterns::getParticleCount(LEDPatternType type) {
+    if (type == LEDPatternTypeBouncingBall) {
+        return m_ballCount != 0 ? m_ballCount : NUMBER_BOUNCE_OBJECTS;
+    }
+    if (m_particleCount != 0) {
+        return m_particleCount;
+    }
+    return max((uint16_t)ceil(NUMBER_LIFE_OBJECTS * m_ledCount), (uint16_t)1);
+}
+
+uint16_t LEDPatterns::getMaxParticleCount() {
+    return max(getParticleCount(LEDPatternTypeLife), getParticleCount(LEDPatternTypeBouncingBall));
+}
+
+// Picks a new speed (about 120 LEDs a second) and direction, slowing down like the rest
+static void pickRandomLifeVelocity(LEDRandom *random, int32_t *velocity, int32_t *acceleration) {
+    *velocity = LIFE_SPEED_FROM_MM(random->random(950, 1000));
+    *acceleration = -LIFE_DECELERATION;
+    if (random->random(2) == 1) {
+        *velocity = -*velocity;
+        *acceleration = -*acceleration;
     }
 }
 
@@ -2163,44 +2823,78 @@ void LEDPatterns::commonInitForPattern() {
         m_ledTempBuffer2 = NULL;
     }
     
-    if (m_stateInfo != NULL) {
-        free(m_stateInfo);
-    }
-    
-    // 10% of the led count...
-    if (m_patternType == LEDPatternTypeBouncingBall) {
-        m_stateInfoCount = NUMBER_BOUNCE_OBJECTS; //ceil(NUMBER_BOUNCE_OBJECTS * m_ledCount);
-    } else {
-        m_stateInfoCount = ceil(NUMBER_LIFE_OBJECTS * m_ledCount);
+    bool bounce = m_patternType == LEDPatternTypeBouncingBall;
+    uint16_t count = getParticleCount(m_patternType);
+    // Sized for the most any of the patterns use, so switching between them doesn't reallocate it
+    if (!m_particles.allocate(getMaxParticleCount())) {
+        return;
     }
-    m_stateInfo = malloc(m_stateInfoCount * sizeof(LEDStateInfo));
-    
-    LEDStateInfo *stateInfo = (LEDStateInfo *)m_stateInfo;
-    int velocity = m_patternType == LEDPatternTypeLifeDynamic ? 0 : 2000;
-    // Go to the dynamic portion....
-    for (int i = 0; i < m_stateInfoCount; i++) {
-        stateInfo[i] = LEDStateInfo(i, m_ledCount, m_stateInfoCount, velocity); // initialize it
-        if (m_patternType == LEDPatternTypeBouncingBall) {
-            stateInfo[i].initForBounce(i, m_stateInfoCount);
+    m_particles.setTime(m_frameTime);
+    const CRGB *rainbow = LEDRainbow::GetColors();
+    for (int i = 0; i < count; i++) {
+        CRGB color = rainbow[(uint8_t)((256UL * i) / count)]; // evenly around the wheel, for any count
+        if (bounce) {
+            // Balls start on the ground and "pop" up at IMPACT0 times their restitution (0.90 - i/count^2); the velocity is the one they leave the ground at
+            uint16_t cor = 58982 - (uint16_t)((65536UL * i) / ((uint32_t)count * count));
+            int p = m_particles.add(0, ((int64_t)IMPACT0 * cor) >> 16, 0, color);
+            m_particles.getRestitutions()[p] = cor;
+        } else {
+            // evenly spaced
+            int32_t position = ((int64_t)LED_PARTICLE_FROM_INT(m_ledCount) * i) / count;
+            int32_t velocity = LIFE_SPEED_FROM_MM(2000);
+            int32_t acceleration = -LIFE_DECELERATION;
+            if (m_patternType == LEDPatternTypeLifeDynamic) {
+                pickRandomLifeVelocity(&m_random, &velocity, &acceleration);
+            }
+            m_particles.add(position, velocity, acceleration, color);
         }
     }
 }
 
+// https://github.com/fibonacci162/LEDs/blob/master/BouncingBalls2014/BouncingBalls2014.ino
 void LEDPatterns::bouncingBallPattern() {
     if (!shouldUpdatePattern()) return;
 
     if (m_firstTime) {
         commonInitForPattern();
     }
-    LEDStateInfo *stateInfo = (LEDStateInfo *)m_stateInfo;
+    // Just the time; the balls aren't moved by the particles, they follow their arc from the last bounce
+    m_particles.setTime(m_frameTime);
+    uint32_t now = m_particles.getTime();
+    int count = m_particles.getCount();
+    int32_t *heights = m_particles.getPositions();
+    int32_t *impacts = m_particles.getVelocities();
+    uint32_t *bounceTimes = m_particles.getTimes();
+    const uint16_t *cors = m_particles.getRestitutions();
+    const CRGB *colors = m_particles.getColors();
+    // 16.16 LEDs a meter, so a height is an LED with one multiply
+    int64_t ledsPerMeter = ((int64_t)(m_ledCount - 1) << 16) / BOUNCE_HEIGHT;
 
     // Intialize all contents to black
     fill_solid(m_leds, m_ledCount, CRGB::Black);
     
-    for (int i = 0; i < m_stateInfoCount; i++) {
-        stateInfo[i].updateBounceColor(m_leds, m_ledCount);
+    for (int i = 0; i < count; i++) {
+        // The time since the last time the ball was on the ground, in seconds; 4294967 is 65536/1000 in 16.16
+        int64_t t = ((uint64_t)(now - bounceTimes[i]) * 4294967) >> 16;
+        
+        // A little kinematics equation calculates positon as a function of time, acceleration (gravity) and intial velocity: v*t - g*t^2/2
+        int64_t height = ((impacts[i] * t) >> 16) - ((GRAVITY * ((t * t) >> 16)) >> 17);
+        
+        if ( height < 0 ) {
+            height = 0;                            // If the ball crossed the threshold of the "ground," put it back on the ground
+            impacts[i] = ((int64_t)impacts[i] * cors[i]) >> 16;   // and recalculate its new upward velocity as it's old velocity * COR
+            bounceTimes[i] = now;
+            
+            if ( impacts[i] < MIN_IMPACT ) impacts[i] = IMPACT0;  // If the ball is barely moving, "pop" it back up at IMPACT0
+        }
+        heights[i] = height;
+        int pos = (height * ledsPerMeter + 0x80000000LL) >> 32;
+        if (pos > (int)m_ledCount - 1) {
+            pos = m_ledCount - 1; // a long frame can put it past the top
+        }
+        m_leds[pos] = colors[i];
     }
-    blur(4, m_leds, getTempBuffer1(), m_ledCount);
+    blur(4, m_leds, m_ledCount);
 }
 
 void LEDPatterns::bitmapPatternFillPixels() {
@@ -2461,17 +3155,42 @@ void LEDPatterns::lifePattern(bool dynamic) {
     if (m_firstTime) {
         commonInitForPattern();
     }
-    LEDStateInfo *stateInfo = (LEDStateInfo *)m_stateInfo;
+    m_particles.update(m_frameTime, m_ledCount);
+    int count = m_particles.getCount();
+    const int32_t *positions = m_particles.getPositions();
+    int32_t *velocities = m_particles.getVelocities();
+    int32_t *accelerations = m_particles.getAccelerations();
+    const CRGB *colors = m_particles.getColors();
     
     // Intialize all contents to black
     fill_solid(m_leds, m_ledCount, CRGB::Black);
 
-    for (int i = 0; i < m_stateInfoCount; i++) {
-        stateInfo[i].update(m_leds, m_ledCount);
+    for (int i = 0; i < count; i++) {
+        // Once it has slowed to a stop (and would start going backwards) it gets a new random speed and direction
+        if (velocities[i] == 0 || (velocities[i] ^ accelerations[i]) >= 0) {
+            pickRandomLifeVelocity(&m_random, &velocities[i], &accelerations[i]);
+        }
+        
+        // Faster is longer, with a tail that fades out behind it
+        int speed = abs(LED_PARTICLE_TO_INT(velocities[i])); // LEDs a second
+        int objectSize = (speed * 2) / 25;
+        if (objectSize == 0) { objectSize = 1; }
+        int fadeStep = 255 / objectSize;
+        int direction = velocities[i] > 0 ? -1 : 1;
+        int pos = LED_PARTICLE_TO_INT(positions[i]);
+        for (int x = 0; x <= objectSize; x++) {
+            if (pos < 0) {
+                pos += m_ledCount;
+            } else if (pos >= (int)m_ledCount) {
+                pos -= m_ledCount;
+            }
+            m_leds[pos] += colors[i] % (uint8_t)(255 - fadeStep*x);
+            pos += direction;
+        }
     }
 
-    //apply a blur to the LED array //3x = 220us, 16x = 1200us
-    blur(3, m_leds, getTempBuffer1(), m_ledCount);
+    //apply a blur to the LED array; the 3 passes are done as one kernel
+    blur(3, m_leds, m_ledCount);
 }
 
 
@@ -2491,8 +3210,13 @@ void LEDPatterns::funkyCloudsPattern() {
     m_initialPixel2 = (uint8_t)(m_initialPixel2 + 2);
     m_initialPixel3 = (uint8_t)(m_initialPixel3 + 1);
     
-    int width =  floor(sqrt(m_ledCount));
-    int height = width;
+    LEDLayout *layout = getLayout();
+    if (layout == NULL) {
+        return;
+    }
+    int width = layout->getWidth();
+    int height = layout->getHeight();
+    m_leds[m_ledCount] = CRGB::Black; // the hole pixel for custom layouts
     // first plant the seed into the buffer
     //buffer[XY(sin8(m_initialPixel)/20, cos8(m_initialPixel1)/17)] = CHSV (count[0] , 255, 255);
     
@@ -2501,9 +3225,12 @@ void LEDPatterns::funkyCloudsPattern() {
 ////        m_leds[i].fadeToBlackBy(1);
 //
 //    }
-    Line(((sin8(m_initialPixel)/17)+(sin8(m_initialPixel2)/17))/2, ((sin8(m_initialPixel1)/17)+(sin8(m_initialPixel3)/17))/2,         // combine 2 wavefunctions for more variety of x
-         ((sin8(m_initialPixel3)/17)+(sin8(m_initialPixel2)/17))/2, ((sin8(m_initialPixel1)/17)+(sin8(m_initialPixel2)/17))/2, m_initialPixel3,
-         m_leds, width, height); // and y, color just simple linear ramp
+    // the sum of two sin8 values scaled to 0..width-1 (or height-1); this was /17 for a 16x16 panel
+    #define SCALE_SUM(a, b, size) (((sin8(a) + sin8(b)) * (size)) >> 9)
+    Line(SCALE_SUM(m_initialPixel, m_initialPixel2, width), SCALE_SUM(m_initialPixel1, m_initialPixel3, height),         // combine 2 wavefunctions for more variety of x
+         SCALE_SUM(m_initialPixel3, m_initialPixel2, width), SCALE_SUM(m_initialPixel1, m_initialPixel2, height), m_initialPixel3,
+         m_leds, layout); // and y, color just simple linear ramp
+    #undef SCALE_SUM
     
     //   just some try and error:
     //Line(sin8(m_initialPixel3)/17, cos8(m_initialPixel1)/17, sin8(count[1])/17, cos8(m_initialPixel2)/17, m_initialPixel3);
@@ -2526,7 +3253,8 @@ void LEDPatterns::funkyCloudsPattern() {
 //    }
     
     // rotate leds
-    Spiral(7,7,10,120, m_leds, width, height);
+    // was 7,7 with a radius of 10 for 16x16
+    Spiral(width/2, height/2, max(width, height)/2 + 2, 120, m_leds, layout);
     
     //DimmAll(230);
     
@@ -2536,56 +3264,87 @@ void LEDPatterns::funkyCloudsPattern() {
     //DimmAll(220);
 }
 
+// The key for the sine wave's colors in the palette cache; the hue goes in the low byte
+#define SIN_WAVE_COLORS_KEY 0x53494E00
+
 void LEDPatterns::sinWaveDemoEffect() {
     if (!shouldUpdatePattern()) {
         return;
     }
 
     if (m_firstTime) {
-        m_initialPixel = random(1536); // Random hue
+        m_initialPixel = m_random.random(1536); // Random hue
         // Number of repetitions (complete loops around color wheel);
         // any more than 4 per meter just looks too chaotic.
         // Store as distance around complete belt in half-degree units:
-        m_initialPixel1 = (1 + random(4 * ((m_ledCount + 31) / 32))) * 720;
+        m_initialPixel1 = (1 + m_random.random(4 * ((m_ledCount + 31) / 32))) * 720;
         // Frame-to-frame increment (speed) -- may be positive or negative,
         // but magnitude shouldn't be so small as to be boring.  It's generally
         // still less than a full pixel per frame, making motion very smooth.
-        m_initialPixel2 = 4 + random(m_initialPixel) / m_ledCount;
+        m_initialPixel2 = 4 + m_random.random(m_initialPixel) / m_ledCount;
         // Reverse direction half the time.
-        if(random(2) == 0) m_initialPixel2 = -m_initialPixel2;
+        if(m_random.random(2) == 0) m_initialPixel2 = -m_initialPixel2;
         m_initialPixel3 = 0; // Current position
     }
     
+    // The hue doesn't change in a run, so every color the sine can make is worked out once, indexed by the sine's byte
+    bool isFilled;
+    CRGB *colors = m_paletteCache.getColorsForKey(SIN_WAVE_COLORS_KEY | (uint8_t)m_initialPixel, &isFilled);
+    if (colors == NULL) {
+        return;
+    }
+    if (!isFilled) {
+        const CRGB *rainbow = LEDRainbow::GetColors();
+        for (int c = 0; c < 256; c++) {
+            int foo = (char)c;
+            // Peaks of sine wave are white, troughs are black, mid-range
+            // values are pure hue (100% saturated).
+            if (foo >= 0) {
+                CHSV hsv = CHSV(m_initialPixel, 254 - (foo * 2), 255);
+                hsv2rgb_rainbow(hsv, colors[c]);
+            } else {
+                // Fully saturated, so only the value changes
+                colors[c] = LEDRainbow::ColorWithValue(rainbow, m_initialPixel, 254 + foo * 2);
+            }
+        }
+    }
+    
+    // Steps along the angle of m_initialPixel3 + m_initialPixel1 * i / m_ledCount, carrying the remainder instead of a multiply and divide for each one
+    int angle = m_initialPixel3 % 720;
+    if (angle < 0) angle += 720;
+    int angleStep = m_initialPixel1 / m_ledCount;
+    int angleRemainderStep = m_initialPixel1 % m_ledCount;
+    int angleRemainder = 0;
     for(int i=0; i<m_ledCount; i++) {
-        int foo = fixSin(m_initialPixel3 + m_initialPixel1 * i / m_ledCount);
-        // Peaks of sine wave are white, troughs are black, mid-range
-        // values are pure hue (100% saturated).
-        if (foo >= 0) {
-            CHSV hsv = CHSV(m_initialPixel, 254 - (foo * 2), 255);
-            hsv2rgb_rainbow(hsv, m_leds[i]);
-        } else {
-            CHSV hsv = CHSV(m_initialPixel, 255, 254 + foo * 2);
-            hsv2rgb_rainbow(hsv, m_leds[i]);
+        m_leds[i] = colors[(uint8_t)fixSinInRange(angle)];
+        angle += angleStep;
+        angleRemainder += angleRemainderStep;
+        if (angleRemainder >= (int)m_ledCount) {
+            angleRemainder -= m_ledCount;
+            angle++;
+        }
+        while (angle >= 720) {
+            angle -= 720;
         }
     }
-    m_initialPixel3 += m_initialPixel2;
+    m_initialPixel3 = (m_initialPixel3 + m_initialPixel2) % 720;
 }
 
 void LEDPatterns::rotatingBottomGlow() {
-    float topPixel = getPercentagePassed()*m_ledCount;
-    bottomGlowFromTopPixel(topPixel);
+    // Goes around once per duration; smoothly, as it isn't rounded to a pixel
+    uint16_t topAngle = (uint32_t)(getPercentagePassed() * 65536.0);
+    bottomGlowFromTopAngle(topAngle);
 }
 
 void LEDPatterns::fadeIn(float percentagePassed) {
     // slow fade in with:
-    // y = x^2, where x == time
+    // y = x^2, where x == time, unless the options have another curve
     if (percentagePassed >= 1.0) {
         fill_solid(m_leds, m_ledCount, m_patternColor);
     } else {
-        float y = percentagePassed*percentagePassed;
-        for (int i = 0; i < m_ledCount; i++) {
-            fadePixel(i, m_patternColor, y);
-        }
+        CRGB c = m_patternColor;
+        LEDEasing::ScaleLEDs(&c, &c, 1, easedFadeLevel(m_patternOptions, LEDEasingTypeQuadratic, percentagePassed));
+        fill_solid(m_leds, m_ledCount, c);
     }
 }
 
@@ -2605,8 +3364,11 @@ CRGB *LEDPatterns::getTempBuffer2() {
 
 void LEDPatterns::fadeOut(float percentagePassed) {
     // Opposite of fade in, and we store the inital value on the first pass
-    // y = -x^2 + 1
+    // y = -x^2 + 1, unless the options have another curve
     CRGB *tempBuffer = getTempBuffer1();
+    if (tempBuffer == NULL) {
+        return;
+    }
     if (m_firstTime) {
         // First pass, store off the initial state..
         memcpy(tempBuffer, m_leds, getBufferSize());
@@ -2616,45 +3378,111 @@ void LEDPatterns::fadeOut(float percentagePassed) {
         // All black
         fill_solid(m_leds, m_ledCount, CRGB::Black);
     } else {
-        float y = -(percentagePassed*percentagePassed)+1;
-        for (int i = 0; i < m_ledCount; i++) {
-            // direct pixel access to avoid issues w/reading the already set brightness
-            m_leds[i].green = tempBuffer[i].green*y;
-            m_leds[i].red = tempBuffer[i].red*y;
-            m_leds[i].blue = tempBuffer[i].blue*y;
-        }
+        // direct from the initial state to avoid issues w/reading the already set brightness
+        uint8_t level = 255 - easedFadeLevel(m_patternOptions, LEDEasingTypeQuadratic, percentagePassed);
+        LEDEasing::ScaleLEDs(m_leds, tempBuffer, m_ledCount, level);
     }
 }
 
-#warning corbin - move to the other rainbow method from CRGB!
-static CRGB hsvToRgb(uint16_t h, uint8_t s, uint8_t v)
-{
-    uint8_t f = (h % 60) * 255 / 60;
-    uint8_t p = v * (255 - s) / 255;
-    uint8_t q = v * (255 - f * s / 255) / 255;
-    uint8_t t = v * (255 - (255 - f) * s / 255) / 255;
-    uint8_t r = 0, g = 0, b = 0;
-    switch((h / 60) % 6){
-        case 0: r = v; g = t; b = p; break;
-        case 1: r = q; g = v; b = p; break;
-        case 2: r = p; g = v; b = t; break;
-        case 3: r = p; g = q; b = v; break;
-        case 4: r = t; g = p; b = v; break;
-        case 5: r = v; g = p; b = q; break;
+// A run of LEDs for drawSegments; a frame of the glow/gradient patterns is a handful of these back to back.
+// The color is scaled by the level, which starts at level and goes up by levelStep each LED (8.16; SEGMENT_LEVEL_FULL is all of it). Rainbow segments take their color from the rainbow at hue (8.16), going up by hueStep each LED.
+typedef struct {
+    uint16_t length;
+    bool isRainbow;
+    CRGB color;
+    uint32_t hue;
+    int32_t hueStep;
+    int32_t level;
+    int32_t levelStep;
+} LEDSegment;
+
+#define SEGMENT_LEVEL_FULL (256L << 16)
+
+static inline LEDSegment offSegment(int length) {
+    LEDSegment result = { (uint16_t)max(length, 0), false, CRGB::Black, 0, 0, 0, 0 };
+    return result;
+}
+
+static inline LEDSegment solidSegment(int length, CRGB color) {
+    LEDSegment result = { (uint16_t)max(length, 0), false, color, 0, 0, SEGMENT_LEVEL_FULL, 0 };
+    return result;
+}
+
+static inline LEDSegment rampSegment(int length, CRGB color, int32_t level, int32_t levelStep) {
+    LEDSegment result = { (uint16_t)max(length, 0), false, color, 0, 0, level, levelStep };
+    return result;
+}
+
+static inline LEDSegment rainbowSegment(int length, uint32_t hue, int32_t hueStep, int32_t level, int32_t levelStep) {
+    LEDSegment result = { (uint16_t)max(length, 0), true, CRGB::Black, hue, hueStep, level, levelStep };
+    return result;
+}
+
+// One piece of a segment that doesn't go over the end of the strip
+static void drawSegmentPiece(CRGB *leds, int count, const LEDSegment &segment, uint32_t hue, int32_t level) {
+    if (!segment.isRainbow && segment.levelStep == 0) {
+        // The same color for all of it
+        uint16_t amount = (level + 0x8000) >> 16;
+        CRGB c = segment.color;
+        if (amount < 256) {
+            c.red = (c.red * amount) >> 8;
+            c.green = (c.green * amount) >> 8;
+            c.blue = (c.blue * amount) >> 8;
+        }
+        fill_solid(leds, count, c);
+        return;
+    }
+    const CRGB *rainbow = segment.isRainbow ? LEDRainbow::GetColors() : NULL;
+    for (int i = 0; i < count; i++) {
+        CRGB c = rainbow ? rainbow[(hue >> 16) & 0xFF] : segment.color;
+        uint16_t amount = (level + 0x8000) >> 16;
+        if (amount < 256) {
+            c.red = (c.red * amount) >> 8;
+            c.green = (c.green * amount) >> 8;
+            c.blue = (c.blue * amount) >> 8;
+        }
+        leds[i] = c;
+        hue += segment.hueStep;
+        level += segment.levelStep;
     }
-    return CRGB(r, g, b);
 }
 
+// Draws the segments one after the other starting at LED position, going around past the end of the strip; each one is split where it wraps instead of checking every LED. Draws up to maxLength LEDs, and returns how many it drew.
+static int drawSegments(CRGB *leds, int ledCount, int position, const LEDSegment *segments, int segmentCount, int maxLength) {
+    if (ledCount <= 0) {
+        return 0;
+    }
+    position %= ledCount;
+    if (position < 0) position += ledCount;
+    int drawn = 0;
+    for (int s = 0; s < segmentCount && drawn < maxLength; s++) {
+        const LEDSegment &segment = segments[s];
+        int length = min((int)segment.length, maxLength - drawn);
+        uint32_t hue = segment.hue;
+        int32_t level = segment.level;
+        while (length > 0) {
+            int count = min(length, ledCount - position);
+            drawSegmentPiece(&leds[position], count, segment, hue, level);
+            hue += segment.hueStep * count;
+            level += segment.levelStep * count;
+            length -= count;
+            drawn += count;
+            position += count;
+            if (position == ledCount) {
+                position = 0;
+            }
+        }
+    }
+    return drawn;
+}
 
 void LEDPatterns::solidRainbow(int positionInWheel, int count) {
     int countPerSection = round(m_ledCount / count);
+    if (countPerSection < 1) countPerSection = 1;
+    const CRGB *rainbow = LEDRainbow::GetColors();
     for (int i = 0; i < m_ledCount; i++) {
-//        uint16_t angle = 360.0 * ((float)((i + positionInWheel) / (float)countPerSection));
-//        CRGB color = hsvToRgb(angle, 255, 255);
-//        setPixelColor(i, color);
-        uint16_t hue = HUE_MAX_RAINBOW * ((float)((i + positionInWheel) / (float)countPerSection));
-        CHSV hsv = CHSV(hue, 255, 255);
-        hsv2rgb_rainbow(hsv, m_leds[i]);
+        uint8_t hue = ((uint32_t)HUE_MAX_RAINBOW * (i + positionInWheel)) / countPerSection; // wraps
+        m_leds[i] = rainbow[hue];
     }
 }
 
@@ -2672,53 +3500,78 @@ void LEDPatterns::rainbowWithSpaces(int count) {
     int pixelsOff = (m_ledCount - (pixelsPerGlow * 4)) / 4.0;
     
     int countPerSection = round(pixelsPerGlow / count);
+    if (countPerSection < 1) countPerSection = 1;
     
-    static const float rampCount = 7;
+    static const int rampCount = 7;
+    // Ramps up over rampCount, and down over the last rampCount - 1 from all the way on
+    int rampUpCount = min(rampCount, pixelsPerGlow);
+    int fullCount = max(pixelsPerGlow - rampUpCount - (rampCount - 1), 0);
+    int rampDownCount = pixelsPerGlow - rampUpCount - fullCount;
+    const int32_t rampStep = SEGMENT_LEVEL_FULL / rampCount;
+    // Once around the wheel each section; 8.16
+    const int32_t hueStep = (1L << 24) / countPerSection;
     
     int pixel = 0;
-    for (int i = 0; i < 8; i++) {
-        if (pixel == m_ledCount) break;
-        for (int j = 0; j < pixelsPerGlow; j++) {
-            uint16_t angle = 360.0 * ((float)((pixel + positionInWheel) / (float)countPerSection));
-            CRGB color = hsvToRgb(angle, 255, 255);
-            if (j < rampCount) {
-                float rampUp = (float)(j+1) / rampCount;
-                fadePixel(pixel, color, rampUp);
-            } else {
-                // close to the end?
-                int howFarToEnd = pixelsPerGlow - j;
-                if (howFarToEnd < rampCount) {
-                    float rampUp = (float)(howFarToEnd+1) / rampCount;
-                    fadePixel(pixel, color, rampUp);
-                } else {
-                    setPixelColor(pixel, color);
-                }
-            }
-            pixel++;
-            if (pixel == m_ledCount) break;
-        }
-        if (pixel == m_ledCount) break;
-        for (int j = 0; j < pixelsOff; j++) {
-            setPixelColor(pixel, CRGB::Black); // off
-            pixel++;
-            if (pixel == m_ledCount) break;
-        }
+    for (int i = 0; i < 8 && pixel < m_ledCount; i++) {
+        uint32_t hue = ((uint64_t)(pixel + positionInWheel) << 24) / countPerSection;
+        LEDSegment segments[4];
+        segments[0] = rainbowSegment(rampUpCount, hue, hueStep, rampStep, rampStep);
+        segments[1] = rainbowSegment(fullCount, hue + hueStep * rampUpCount, hueStep, SEGMENT_LEVEL_FULL, 0);
+        segments[2] = rainbowSegment(rampDownCount, hue + hueStep * (rampUpCount + fullCount), hueStep, SEGMENT_LEVEL_FULL, -rampStep);
+        segments[3] = offSegment(pixelsOff);
+        pixel += drawSegments(m_leds, m_ledCount, pixel, segments, 4, m_ledCount - pixel);
     }
 }
 
 
+// How many LEDs the chase moves each duration
+#define CHASE_STEPS_PER_DURATION 6
+
 void LEDPatterns::theaterChase() {
-    // The duration speeds up or slows down how fast we chase
-    int swipePosition = round(getPercentagePassed()*6);
+    // One period of the chase, made when it starts; each frame stamps it along the strip from where the chase is at
+    CRGB *tile = getTempBuffer1();
+    if (tile == NULL || m_ledCount == 0) {
+        return;
+    }
+    int onCount = m_patternOptions.chaseOptions.onCount;
+    if (onCount == 0) onCount = 1;
+    int offCount = m_patternOptions.chaseOptions.offCount;
+    if (offCount == 0) offCount = 4;
+    const CRGB *colors = m_chaseColors ? m_chaseColors : &m_patternColor;
+    int colorCount = m_chaseColors ? m_chaseColorCount : 1;
+    int period = min(colorCount * (onCount + offCount), (int)m_ledCount);
     
-    for (int i = 0; i < m_ledCount; i++) {
-        // TODO: add options for spacing.
-        if ((swipePosition + i) % 5 == 0) {
-            setPixelColor(i, m_patternColor);
-        } else {
-            setPixelColor(i, CRGB::Black);
+    if (m_firstTime) {
+        int pixel = 0;
+        for (int c = 0; c < colorCount && pixel < period; c++) {
+            int count = min(onCount, period - pixel);
+            fill_solid(&tile[pixel], count, colors[c]);
+            pixel += count;
+            count = min(offCount, period - pixel);
+            fill_solid(&tile[pixel], count, CRGB::Black);
+            pixel += count;
         }
     }
+    
+    // The duration speeds up or slows down how fast we chase
+    int swipePosition = round(getPercentagePassed()*CHASE_STEPS_PER_DURATION);
+    int offset = swipePosition % period;
+    if (m_patternOptions.chaseOptions.reverse) {
+        offset = (period - offset) % period;
+    }
+    
+    // The first period is the tile rotated by the offset; after that it is copies of what is already there, doubling each time
+    int count = min(period - offset, (int)m_ledCount);
+    memcpy(m_leds, &tile[offset], sizeof(CRGB) * count);
+    if (count < period) {
+        memcpy(&m_leds[count], tile, sizeof(CRGB) * min(offset, (int)m_ledCount - count));
+    }
+    int done = period;
+    while (done < (int)m_ledCount) {
+        count = min(done, (int)m_ledCount - done);
+        memcpy(&m_leds[done], m_leds, sizeof(CRGB) * count);
+        done += count;
+    }
 }
 
 // wipe a color on
@@ -2799,49 +3652,16 @@ void LEDPatterns::pulseGradientEffect() {
 }
 
 int LEDPatterns::gradientOverXPixels(int pixel, int fullCount, int offCount, int fadeCount, CRGB color) {
-    for (int i = 0; i < offCount; i++) {
-        WRAP_AROUND(pixel, m_ledCount);
-        setPixelColor(pixel, 0);
-        pixel++;
-    }
-    
-    // Fade on
-    for (int i = 0; i < fadeCount; i++) {
-        WRAP_AROUND(pixel, m_ledCount);
-        float percentage = (float)(i + 1) / (float)fadeCount;
-        CRGB c = color;
-        c.red *= percentage;
-        c.green *= percentage;
-        c.blue *= percentage;
-        setPixelColor(pixel, c);
-        pixel++;
-    }
-    
-    // Full on
-    for (int i = 0; i < fullCount; i++) {
-        WRAP_AROUND(pixel, m_ledCount);
-        setPixelColor(pixel, color);
-        pixel++;
-    }
-    
-    // Fade off
-    for (int i = 0; i < fadeCount; i++) {
-        WRAP_AROUND(pixel, m_ledCount);
-        float percentage = 1.0 - ((float)i / (float)fadeCount);
-        CRGB c = color;
-        c.red *= percentage;
-        c.green *= percentage;
-        c.blue *= percentage;
-        setPixelColor(pixel, c);
-        pixel++;
-    }
-    
-    for (int i = 0; i < offCount; i++) {
-        WRAP_AROUND(pixel, m_ledCount);
-        setPixelColor(pixel, 0);
-        pixel++;
-    }
-    return pixel;
+    int32_t fadeStep = fadeCount > 0 ? SEGMENT_LEVEL_FULL / fadeCount : 0;
+    LEDSegment segments[5];
+    segments[0] = offSegment(offCount);
+    segments[1] = rampSegment(fadeCount, color, fadeStep, fadeStep); // Fade on
+    segments[2] = solidSegment(fullCount, color); // Full on
+    segments[3] = rampSegment(fadeCount, color, SEGMENT_LEVEL_FULL, -fadeStep); // Fade off
+    segments[4] = offSegment(offCount);
+    int length = max(offCount, 0) * 2 + max(fadeCount, 0) * 2 + max(fullCount, 0);
+    drawSegments(m_leds, m_ledCount, pixel, segments, 5, length);
+    return (pixel + length) % (int)m_ledCount;
 }
 
 
@@ -2855,10 +3675,10 @@ void LEDPatterns::randomGradients() {
     
     if (m_firstTime) {
         // generate an initial random color for each gradient
+        const CRGB *rainbow = LEDRainbow::GetColors();
         for (int i = 0; i < numberOfGradients; i++) {
             // Well, not really random..
-            CHSV hsv = CHSV(HUE_MAX_RAINBOW*((float)i / (float)numberOfGradients), 255, 255);
-            hsv2rgb_rainbow(hsv, tmpBuffer[i]);
+            tmpBuffer[i] = rainbow[(uint8_t)(HUE_MAX_RAINBOW*((float)i / (float)numberOfGradients))];
         }
     }
     
@@ -2880,20 +3700,239 @@ void LEDPatterns::randomGradients() {
     //    }
 }
 
+bool LEDPatterns::setLayout(LEDLayoutType type, uint16_t width, uint16_t height) {
+    if (width*height > m_ledCount) {
+        DEBUG_PRINTLN("layout is bigger than the LED count");
+        return false;
+    }
+    return m_layout.setLayout(type, width, height);
+}
+
+bool LEDPatterns::setCustomLayout(const uint8_t *xyTable, uint16_t width, uint16_t height) {
+    return m_layout.setCustomLayout(xyTable, m_ledCount, width, height, m_ledCount);
+}
+
+LEDLayout *LEDPatterns::getLayout() {
+    if (!m_layout.isValid()) {
+        // What the 2D patterns always assumed
+        int size = floor(sqrt(m_ledCount));
+        if (!m_layout.setLayout(LEDLayoutTypeColumnSerpentine, size, size)) {
+            return NULL;
+        }
+    }
+    return &m_layout;
+}
+
+void LEDPatterns::setAudioSource(LEDAudioSource *source) {
+    if (source == NULL) {
+        if (m_audio) {
+            delete m_audio;
+            m_audio = NULL;
+        }
+    } else if (m_audio) {
+        m_audio->setSource(source);
+    } else {
+        m_audio = new LEDAudioAnalyzer(source);
+    }
+}
+
+LEDAudioAnalyzer *LEDPatterns::getAudio() {
+    if (m_audio) {
+        m_audio->update(m_frameTime);
+    }
+    return m_audio;
+}
+
+LEDGeometry *LEDPatterns::getGeometry() {
+    if (!m_geometry.isValid()) {
+        if (!m_geometry.allocate(m_ledCount)) {
+            return NULL;
+        }
+    }
+    return &m_geometry;
+}
+
+bool LEDPatterns::enableOutputStage(bool enable) {
+    if (enable) {
+        if (m_outputLeds == NULL) {
+            m_outputLeds = (CRGB *)malloc(getBufferSize());
+            m_outputTable = (uint8_t *)malloc(3*256);
+            if (m_outputLeds == NULL || m_outputTable == NULL) {
+                DEBUG_PRINTLN("not enough RAM for the output stage");
+                enableOutputStage(false);
+                return false;
+            }
+            buildOutputTable();
+            applyOutputStage();
+        }
+    } else {
+        setOutputDithering(false);
+        if (m_outputLeds) {
+            free(m_outputLeds);
+            m_outputLeds = NULL;
+        }
+        if (m_outputTable) {
+            free(m_outputTable);
+            m_outputTable = NULL;
+        }
+    }
+    return true;
+}
+
+bool LEDPatterns::setOutputDithering(bool dither) {
+    if (dither) {
+        if (m_outputLeds == NULL) {
+            return false; // needs the output stage
+        }
+        if (m_outputResidual == NULL) {
+            m_outputTable16 = (uint16_t *)malloc(3*256*sizeof(uint16_t));
+            m_outputResidual = (uint8_t *)malloc(3*m_ledCount);
+            if (m_outputTable16 == NULL || m_outputResidual == NULL) {
+                DEBUG_PRINTLN("not enough RAM for dithering");
+                setOutputDithering(false);
+                return false;
+            }
+            // Start at half so the first frame rounds
+            memset(m_outputResidual, 0x80, 3*m_ledCount);
+            buildOutputTable();
+        }
+    } else {
+        if (m_outputTable16) {
+            free(m_outputTable16);
+            m_outputTable16 = NULL;
+        }
+        if (m_outputResidual) {
+            free(m_outputResidual);
+            m_outputResidual = NULL;
+        }
+    }
+    return true;
+}
+
+bool LEDPatterns::setPowerLimit(uint32_t milliamps) {
+    m_powerLimit = milliamps;
+    return milliamps == 0 || m_outputLeds != NULL;
+}
+
+void LEDPatterns::setPowerModel(uint8_t redMilliamps, uint8_t greenMilliamps, uint8_t blueMilliamps, uint8_t idleMilliamps) {
+    m_channelMilliamps[0] = redMilliamps;
+    m_channelMilliamps[1] = greenMilliamps;
+    m_channelMilliamps[2] = blueMilliamps;
+    m_idleMilliamps = idleMilliamps;
+}
+
+void LEDPatterns::setOutputGamma(float red, float green, float blue) {
+    m_outputGamma[0] = red;
+    m_outputGamma[1] = green;
+    m_outputGamma[2] = blue;
+    buildOutputTable();
+}
+
+void LEDPatterns::setWhiteBalance(CRGB whiteBalance) {
+    m_whiteBalance = whiteBalance;
+    buildOutputTable();
+}
+
+void LEDPatterns::setOutputBrightness(uint8_t brightness) {
+    m_outputBrightness = brightness;
+    buildOutputTable();
+}
+
+// Only done when a setting changes, so the float math is fine
+void LEDPatterns::buildOutputTable() {
+    if (m_outputTable == NULL) {
+        return;
+    }
+    for (int c = 0; c < 3; c++) {
+        uint8_t *table = &m_outputTable[c*256];
+        // White balance and brightness are both just a scale, so combine them
+        float scale = (m_whiteBalance[c] / 255.0) * (m_outputBrightness / 255.0) * 255.0;
+        float gamma = m_outputGamma[c];
+        uint16_t *table16 = m_outputTable16 ? &m_outputTable16[c*256] : NULL;
+        for (int v = 0; v < 256; v++) {
+            float value = gamma == 1.0 ? v / 255.0 : pow(v / 255.0, gamma);
+            table[v] = (uint8_t)(value * scale + 0.5);
+            if (table16) {
+                // 255.0 in 8.8 is the max, so adding a residual can't overflow
+                table16[v] = (uint16_t)(value * scale * 256.0 + 0.5);
+            }
+        }
+    }
+}
+
+void LEDPatterns::applyOutputStage() {
+    // The channel totals for the power estimate are summed up as we go, so it doesn't take another pass
+    uint32_t sums[3] = { 0, 0, 0 };
+    if (m_outputResidual) {
+        const uint16_t *table16 = m_outputTable16;
+        const uint8_t *src = (const uint8_t *)m_leds;
+        uint8_t *dest = (uint8_t *)m_outputLeds;
+        uint8_t *residual = m_outputResidual;
+        // CRGB is 3 bytes of r, g, b
+        for (int i = 0; i < m_ledCount; i++) {
+            for (int c = 0; c < 3; c++) {
+                uint16_t value = table16[c*256 + *src++] + *residual;
+                *dest = value >> 8;
+                sums[c] += *dest++;
+                *residual++ = value & 0xFF;
+            }
+        }
+    } else {
+        const uint8_t *redTable = m_outputTable;
+        const uint8_t *greenTable = m_outputTable + 256;
+        const uint8_t *blueTable = m_outputTable + 512;
+        const CRGB *src = m_leds;
+        CRGB *dest = m_outputLeds;
+        for (int i = 0; i < m_ledCount; i++) {
+            uint8_t r = redTable[src[i].red];
+            uint8_t g = greenTable[src[i].green];
+            uint8_t b = blueTable[src[i].blue];
+            dest[i].red = r;
+            dest[i].green = g;
+            dest[i].blue = b;
+            sums[0] += r;
+            sums[1] += g;
+            sums[2] += b;
+        }
+    }
+    
+    uint32_t idleMilliamps = m_idleMilliamps * m_ledCount;
+    uint32_t channelMilliamps = (sums[0]*m_channelMilliamps[0] + sums[1]*m_channelMilliamps[1] + sums[2]*m_channelMilliamps[2]) / 255;
+    m_estimatedMilliamps = idleMilliamps + channelMilliamps;
+    
+    // Only frames over the budget pay for a second pass. A black frame can be over it from the idle current alone, and there is nothing to scale then.
+    if (m_powerLimit != 0 && m_estimatedMilliamps > m_powerLimit && channelMilliamps != 0) {
+        uint32_t available = m_powerLimit > idleMilliamps ? m_powerLimit - idleMilliamps : 0;
+        uint32_t scale = (available * 256) / channelMilliamps;
+        if (scale > 255) {
+            scale = 255;
+        }
+        nscale8(m_outputLeds, m_ledCount, scale);
+        m_estimatedMilliamps = idleMilliamps + ((channelMilliamps * scale) >> 8);
+    }
+}
+
+void LEDPatterns::showOutput() {
+    if (m_outputLeds) {
+        applyOutputStage();
+    }
+    internalShow();
+}
+
 void LEDPatterns::flashThreeTimes(CRGB color, uint32_t delayAmount) {
     for (int i = 0; i < 3; i++) {
         fill_solid(m_leds, m_ledCount, color);
-        internalShow();
+        showOutput();
         delay(delayAmount);
         fill_solid(m_leds, m_ledCount, CRGB::Black);
-        internalShow();
+        showOutput();
         delay(delayAmount);
     }
 }
 
 void LEDPatterns::flashOnce(CRGB color) {
     fill_solid(m_leds, m_ledCount, color);
-    internalShow();
+    showOutput();
     delay(250);
 }
 
@@ -2907,7 +3946,7 @@ void LEDPatterns::showProgress(float progress, CRGB color) {
     for (int i = 0; i < max; i++) {
         setPixelColor(i, color);
     }
-    internalShow();
+    showOutput();
 }
 
 
@@ -17,6 +17,15 @@
 
 #include "LEDPatternType.h"
 #include "CDLazyBitmap.h"
+#include "LEDLayout.h"
+#include "LEDGeometry.h"
+#include "LEDAudio.h"
+#include "LEDRandom.h"
+#include "LEDPaletteCache.h"
+#include "LEDRainbow.h"
+#include "LEDEasing.h"
+#include "LEDBlend.h"
+#include "LEDParticles.h"
 
 
 class LEDPatterns {
@@ -28,7 +37,10 @@ private:
     
     uint32_t m_firstTime:1;
     uint32_t m_needsInternalShow:1;
-    uint32_t m_reserved:30;
+    uint32_t m_transitionOutgoingValid:1;
+    uint32_t m_transitionIncomingValid:1;
+    uint32_t m_hasNextPatternColor:1;
+    uint32_t m_reserved:27;
     
     uint32_t m_duration;
     uint32_t m_timePassed;
@@ -46,12 +58,13 @@ private:
     
     CRGB *m_ledTempBuffer1;
     CRGB *m_ledTempBuffer2;
-    void *m_stateInfo;
     int m_stateInfoCount;
-    
-    CRGB m_randColor1; // These could be pointers into the temp buffer
-    CRGB m_randColor2;
-    CRGB m_randColor3;
+    // For life and the bouncing balls
+    LEDParticles m_particles;
+    uint16_t m_particleCount; // 0 is the default for the LED count
+    uint16_t m_ballCount; // 0 is the default
+    uint16_t getParticleCount(LEDPatternType type);
+    uint16_t getMaxParticleCount(); // what the pool is sized for, so it is allocated once
     
     // These are just a direct port over of the pololu example code made up into a single class
     unsigned int m_loopCount;
@@ -59,11 +72,32 @@ private:
     unsigned int m_state;
     unsigned int m_count;
     
+    LEDRandom m_random; // the current pattern's own stream; all the patterns use this instead of random()
+    uint32_t m_randomSeed; // each new pattern gets a stream from this, and it goes up by one each time
+    
     uint32_t m_pauseTime; // When non-0, we are paused
     
     void _showFromTime(uint32_t now);
+    void _updatePatternFromTime(uint32_t now); // does everything _showFromTime does except the show
+    uint32_t m_frameTime; // the "now" of the frame being rendered
+    
+    // Live transitions. Each side is a state snapshot blob that gets restored, ticked and snapshotted again every frame. The blobs are preallocated by allocateTransitionPool.
+    uint8_t *m_transitionOutgoing;
+    uint8_t *m_transitionIncoming;
+    uint32_t m_transitionSlotSize;
+    uint32_t m_nextPatternDuration; // 0 means use the crossfade's duration
+    CRGB m_nextPatternColor; // only when m_hasNextPatternColor; otherwise the crossfade's color
+    LEDPatternOptions m_nextPatternOptions;
+    uint32_t getMaxStateSnapshotSize();
+    bool _restoreState(const void *blob, uint32_t blobSize, bool keepClockRunning);
+    void renderTransitionSlot(uint8_t *blob, uint32_t now);
     // lazy bitmaps will replace my file format and file reading (soon!)
     CDPatternBitmap *m_lazyBitmap;
+#if SD_CARD_SUPPORT
+    // The bitmap of the pattern going out in a live transition, after a new one has been set for the pattern coming in
+    CDPatternBitmap *m_transitionOutgoingBitmap;
+    void releaseTransitionOutgoingBitmap();
+#endif
     
     inline int getBufferSize() { return sizeof(CRGB) * m_ledCount; }
     CRGB *getTempBuffer1();
@@ -86,8 +120,7 @@ private:
 private: // Patterns
     // Pattern implementations by corbin
     void wavePattern();
-    void wavePatternWithColor(CRGB c, int initialPixel);
-    void bottomGlowFromTopPixel(float topPixel);
+    void bottomGlowFromTopAngle(uint16_t topAngle);
     void bottomGlow();
     void rotatingBottomGlow();
     void fadeIn(float percentagePassed);
@@ -108,9 +141,18 @@ private: // Patterns
     void firePatternWithColor(bool blue);
     
     void fireColorWithPalette(const CRGBPalette16& pal, int cooling, int sparking);
+    // Use instead of ColorFromPalette; all the palette patterns share it
+    LEDPaletteCache m_paletteCache;
     void flagEffect();
+    CRGB *m_flagColors; // NULL for the default
+    uint8_t m_flagColorCount;
+    CRGB *m_chaseColors; // NULL for the pattern color
+    uint8_t m_chaseColorCount;
     void sinWaveDemoEffect();
     void funkyCloudsPattern();
+    void audioSpectrumPattern();
+    void audioBeatPulsePattern();
+    void audioFirePattern();
     
     void commonInitForPattern();
     void lifePattern(bool dynamic);
@@ -122,11 +164,50 @@ private: // Patterns
     void bitmapPatternStretchFillPixels();
     void bitmapPatternInterpolatePixels(float percentage, bool isChasingPattern);
     
-    // Fades smoothly to the next pattern from the current data shown over the duration of the pattern
-    void crossFadeToNextPattern();
+    // Fades smoothly (or wipes, dissolves..) to the next pattern from the current data shown over the duration of the pattern
+    void transitionToNextPattern();
+    // Same, but both patterns keep animating during the transition; used when the transition pool is allocated
+    void liveTransitionToNextPattern();
+    // Writes the transition's frame into m_leds; amount is 0 (all from) to 256 (all to)
+    void composeTransition(const CRGB *from, const CRGB *to, uint16_t amount);
+    
+    // Per pixel thresholds for the threshold transitions; a pixel shows the next pattern once the amount passes its threshold. Generated once per transition type.
+    uint8_t *m_transitionMap;
+    LEDPatternType m_transitionMapType;
+    uint8_t *getTransitionMap(LEDPatternType transitionType);
+    
+    // Output stage: gamma, white balance and brightness folded into one lookup table and applied in a single pass from m_leds into m_outputLeds when showing. Everything is NULL until enableOutputStage.
+    CRGB *m_outputLeds;
+    uint8_t *m_outputTable; // 3 tables of 256; red, green then blue
+    float m_outputGamma[3];
+    CRGB m_whiteBalance;
+    uint8_t m_outputBrightness;
+    // Temporal dithering: the same table in 8.8 fixed point, and the fraction each LED channel didn't show last frame, which gets added to the next one
+    uint16_t *m_outputTable16;
+    uint8_t *m_outputResidual; // 3 per LED
+    // Power limiting; the current is estimated from the channel totals summed up in the output pass
+    uint32_t m_powerLimit; // mA; 0 is no limit
+    uint32_t m_estimatedMilliamps;
+    uint8_t m_channelMilliamps[3]; // at full on
+    uint8_t m_idleMilliamps; // per LED, even when black
+    void buildOutputTable();
+    void applyOutputStage();
+    
+    // For the 2D patterns. m_leds has one extra pixel past the end that isn't shown, so holes in a custom layout have somewhere to go.
+    LEDLayout m_layout;
+    LEDLayout *getLayout();
+    // For the angle based patterns; see getGeometry
+    LEDGeometry m_geometry;
+    // Shared by the audio patterns; NULL until there is a source
+    LEDAudioAnalyzer *m_audio;
+    LEDAudioAnalyzer *getAudio(); // analyzed for this frame
     
     void updateLEDsForPatternType(LEDPatternType patternType);
     
+    // Which temp buffers hold state (not just scratch) for a pattern; bit 0 is buffer 1, bit 1 is buffer 2
+    static uint8_t PatternTempBufferStateMask(LEDPatternType p);
+    static bool PatternUsesParticles(LEDPatternType p);
+    
     // Patterns taken from pololu demo
     void warmWhiteShimmer();
     void randomColorWalk(unsigned char initializeColors, unsigned char dimOnly);
@@ -140,13 +221,19 @@ private: // Patterns
 protected:
     CRGB *m_leds;
     inline void setPixelColor(int pixel, CRGB color) { m_leds[pixel] = color; };
+    // Runs the output stage (if enabled) and then internalShow
+    void showOutput();
 public:
     
-    LEDPatterns(uint32_t ledCount) : m_ledCount(ledCount), m_duration(1000), m_pauseTime(0), m_needsInternalShow(true), m_firstTime(true) {
-        int byteCount = sizeof(CRGB) * ledCount;
+    LEDPatterns(uint32_t ledCount) : m_ledCount(ledCount), m_duration(1000), m_pauseTime(0), m_needsInternalShow(true), m_firstTime(true), m_transitionOutgoingValid(false), m_transitionIncomingValid(false), m_hasNextPatternColor(false), m_ledTempBuffer1(NULL), m_ledTempBuffer2(NULL), m_stateInfoCount(0), m_particleCount(0), m_ballCount(0), m_randomSeed(0), m_transitionOutgoing(NULL), m_transitionIncoming(NULL), m_transitionSlotSize(0), m_nextPatternDuration(0), m_nextPatternOptions(0), m_lazyBitmap(NULL), m_flagColors(NULL), m_flagColorCount(0), m_chaseColors(NULL), m_chaseColorCount(0), m_transitionMap(NULL), m_transitionMapType(LEDPatternTypeCount), m_outputLeds(NULL), m_outputTable(NULL), m_whiteBalance(255, 255, 255), m_outputBrightness(255), m_outputTable16(NULL), m_outputResidual(NULL), m_powerLimit(0), m_estimatedMilliamps(0), m_idleMilliamps(1), m_audio(NULL) {
+        int byteCount = sizeof(CRGB) * (ledCount + 1); // the last is the hole pixel for layouts
         m_leds = (CRGB *)malloc(byteCount);
         bzero(m_leds, byteCount);
-        randomSeed(m_seed);
+        m_outputGamma[0] = m_outputGamma[1] = m_outputGamma[2] = 2.2;
+        m_channelMilliamps[0] = m_channelMilliamps[1] = m_channelMilliamps[2] = 20; // WS2812
+#if SD_CARD_SUPPORT
+        m_transitionOutgoingBitmap = NULL;
+#endif
     };
     
     ~LEDPatterns() {
@@ -157,26 +244,57 @@ public:
         if (m_ledTempBuffer2) {
             free(m_ledTempBuffer2);
         }
+        freeTransitionPool();
+        if (m_transitionMap) {
+            free(m_transitionMap);
+        }
+        if (m_flagColors) {
+            free(m_flagColors);
+        }
+        if (m_chaseColors) {
+            free(m_chaseColors);
+        }
+        enableOutputStage(false);
+        if (m_audio) {
+            delete m_audio;
+        }
     }
     
     // a given pattern does NOT need a duration set if it is continuous
     static bool PatternIsContinuous(LEDPatternType p);
     static bool PatternNeedsDuration(LEDPatternType p);
     static bool PatternDurationShouldBeEqualToSegmentDuration(LEDPatternType p);
+    // Crossfade, wipe, iris and dissolve go from the current pattern to the next pattern type
+    static bool PatternIsTransition(LEDPatternType p);
 
     // Call begin before doing anything
     virtual void begin() {
 //        DEBUG_PRINTLN("LEDPatterns::begin\r\n");
         // start all off..
         fill_solid(m_leds, getLEDCount(), CRGB::Black);
-        internalShow();
+        showOutput();
     }
     
     // Primary way to change patterns by calling setPatternType; this re-intializes things
     void setPatternType(LEDPatternType type);
     inline LEDPatternType getPatternType() { return m_patternType; }
     
-    void setNextPatternType(LEDPatternType nextType) { m_nextPatternType = nextType; } // Only needed for crossfade pattern
+    void setNextPatternType(LEDPatternType nextType); // Only needed for crossfade pattern
+    // The random patterns play back exactly the same way for the same seed (and order of setPatternType calls). Pass something like analogRead of a floating pin for a different show each time.
+    inline void setRandomSeed(uint32_t seed) { m_randomSeed = seed; }
+    // Allocates the temp buffers the given pattern type will use so it doesn't happen when it starts; mainly for LEDPlaylist to call before it switches.
+    void preparePatternType(LEDPatternType type);
+    // Optional duration for the next pattern while it is fading in with a live crossfade; 0 uses the crossfade's duration
+    inline void setNextPatternDuration(uint32_t duration) { m_nextPatternDuration = duration; }
+    // The color and options the next pattern fades in with. The transition's own options are for the transition, so the default is LEDPatternOptions(0); the color defaults to the transition's color.
+    inline void setNextPatternColor(CRGB color) { m_nextPatternColor = color; m_hasNextPatternColor = true; }
+    inline void setNextPatternOptions(LEDPatternOptions options) { m_nextPatternOptions = options; }
+    
+    // Allocating the transition pool makes the transition patterns (LEDPatternTypeCrossfade, wipe, iris and dissolve) keep both the outgoing and incoming pattern animating, instead of going between two still frames. Calling setPatternType with the transition's next pattern type afterwards continues that pattern rather than restarting it, and a transition can start in the middle of another one.
+    // The pool is two snapshot blobs sized for the largest pattern state, so transitions don't allocate once it exists. Returns false if there isn't enough RAM.
+    bool allocateTransitionPool();
+    void freeTransitionPool();
+    inline bool hasTransitionPool() { return m_transitionOutgoing != NULL; }
     
     // A pattern's speed is based on its duration. Some patterns ignore this, and others adhere to it. After each duration "tick" happens, the interval count is increased.
     inline void setPatternDuration(uint32_t duration) { m_duration = duration; } // in ms; must be > 0
@@ -184,25 +302,31 @@ public:
     // Some patterns are based off a primary color
     inline void setPatternColor(CRGB color) { m_patternColor = color; };
     inline void setPatternOptions(LEDPatternOptions patternOptions) { m_patternOptions = patternOptions; }
+    // The colors LEDPatternFlagEffect stretches over the strip, waving; ie: one for each stripe. The default is an American flag. Passing NULL goes back to it. Returns false if there isn't enough RAM.
+    bool setFlagColors(const CRGB *colors, uint8_t count);
+    bool setFlagColors(const CRGBPalette16 &palette);
+    // The colors LEDPatternTypeTheaterChase goes through, one run of LEDChasePatternOptions.onCount each; NULL goes back to the pattern color. It takes effect when the pattern starts.
+    bool setChaseColors(const CRGB *colors, uint8_t count);
+#if SD_CARD_SUPPORT
+    // The first row of a bitmap (up to 255 pixels); ie: a flag drawn in an image editor. This uses the temp buffers to load it, so do it before starting a pattern.
+    bool loadFlagColors(const char *filename);
+#endif
+    // How many things move around in the life patterns; 0 is the default of 10% of the LEDs. Takes effect when the pattern starts. Call before allocateTransitionPool, as the pool is sized for it.
+    inline void setParticleCount(uint16_t count) { m_particleCount = count; }
+    // How many bouncing balls; 0 is the default of 10. Same rules as setParticleCount.
+    inline void setBallCount(uint16_t count) { m_ballCount = count; }
     
 
 #if SD_CARD_SUPPORT
     // For LEDPatternTypeImage* and LEDPatternTypeBitmap, you MUST set the filename to read from. Calling this method loads the bitmap right at that moment.
     inline void setBitmapFilename(const char *filename) {
-        if (m_lazyBitmap) {
-            delete m_lazyBitmap;
-            m_lazyBitmap = NULL;
-        }
-        if (filename != NULL) {
-            if (m_lazyBitmap == NULL) {
-//                wait, don't I use the buffers for crossfade? this won't work...
-                m_lazyBitmap = new CDPatternBitmap(filename, getTempBuffer1(), getTempBuffer2(), getBufferSize());
-            } else {
-                m_lazyBitmap->moveToStart();
-            }
-        }
+        setBitmap(filename != NULL ? new CDPatternBitmap(filename) : NULL);
     }
     
+    // Takes ownership of a bitmap that was created with CDPatternBitmap(filename) and loaded ahead of time with loadStep(); anything that wasn't loaded yet is loaded now.
+    // When a transition is running, set it after setPatternType: the old bitmap is kept for the pattern going out until the transition is done.
+    void setBitmap(CDPatternBitmap *bitmap);
+    
     inline CDPatternBitmap *getBitmap() { return m_lazyBitmap; }
     
 #endif
@@ -213,6 +337,44 @@ public:
         FastLED.setBrightness(brightness);
     }
     
+    // The output stage corrects the rendered LEDs before they are shown: per channel gamma, then white balance, then brightness. The patterns keep rendering into getLEDs() untouched, and the corrected colors go to a separate buffer, so the subclass has to give getOutputLEDs() to the driver (it is the same as getLEDs() when the output stage is off).
+    // Costs 3*ledCount + 768 bytes of RAM. Returns false if that couldn't be allocated.
+    bool enableOutputStage(bool enable);
+    inline bool isOutputStageEnabled() { return m_outputLeds != NULL; }
+    inline CRGB *getOutputLEDs() { return m_outputLeds ? m_outputLeds : m_leds; }
+    // Default gamma is 2.2; 1.0 is linear (off)
+    void setOutputGamma(float red, float green, float blue);
+    inline void setOutputGamma(float gamma) { setOutputGamma(gamma, gamma, gamma); }
+    // The color full white shows as; ie: to tone down blue on strips that are too blue
+    void setWhiteBalance(CRGB whiteBalance);
+    // Done in the lookup table, so it is free, unlike setBrightness which FastLED does when writing out
+    void setOutputBrightness(uint8_t brightness);
+    inline uint8_t getOutputBrightness() { return m_outputBrightness; }
+    
+    // Temporal dithering keeps the fraction the gamma and brightness table computes and carries it over to the next frame, so dim fades smoothly instead of stepping through the few 8-bit values at the bottom. Needs the output stage enabled; costs 3*ledCount + 1536 bytes. Turn off FastLED's own dithering (FastLED.setDither(0)) when using it.
+    bool setOutputDithering(bool dither);
+    inline bool isOutputDithering() { return m_outputResidual != NULL; }
+    
+    // Scales the whole frame down when the estimated current of the strip goes over the budget, so a battery doesn't brown out on full white. The estimate is made in the output stage pass, and only frames over the limit take a second pass to scale it. Needs the output stage; returns false if it isn't enabled. 0 turns it off.
+    bool setPowerLimit(uint32_t milliamps);
+    inline uint32_t getPowerLimit() { return m_powerLimit; }
+    // Current draw of one LED for each channel at full, and when off. Defaults are 20mA per channel and 1mA idle (WS2812).
+    void setPowerModel(uint8_t redMilliamps, uint8_t greenMilliamps, uint8_t blueMilliamps, uint8_t idleMilliamps);
+    // For the last frame shown, after limiting; only valid with the output stage
+    inline uint32_t getEstimatedMilliamps() { return m_estimatedMilliamps; }
+    
+    // The 2D patterns (funky clouds) go through the layout to find which LED is at an x,y. The default is the square column serpentine the patterns always assumed, sized to the LED count.
+    // width*height can't be more than the LED count. Returns false if it is, or there isn't enough RAM for the map (2 bytes per cell).
+    bool setLayout(LEDLayoutType type, uint16_t width, uint16_t height);
+    // xyTable is the x,y of each LED, 2 bytes per LED
+    bool setCustomLayout(const uint8_t *xyTable, uint16_t width, uint16_t height);
+    
+    // The angle and radius of each LED, for the angle based patterns (bottom glow). Set up the rings, spacing and where the top is on the returned geometry; it starts as one even ring with LED 0 at the top. Returns NULL if there isn't enough RAM for it.
+    LEDGeometry *getGeometry();
+    
+    // Where the audio patterns get their sound from: a LEDAudioRingSource fed by the ADC on the device, or a LEDAudioWAVSource in the pattern editor. The source isn't owned, and NULL turns it off. The analysis (an FFT into bands, the level and beats) is done once a frame, only when an audio pattern is showing.
+    void setAudioSource(LEDAudioSource *source);
+    
     // only updates the LEDs with current state; mainly for subclassing
     virtual void internalShow() { // protected?
         FastLED.show();
@@ -241,6 +403,14 @@ public:
     inline uint32_t getPauseTime() { return m_pauseTime; } // Non-0 if paused; else the time we paused at
     
     void setDurationPassed(uint32_t timePassedInMS, uint32_t now); 
+    
+    // State snapshots let you flip between live patterns without re-initializing them. A snapshot holds the pattern type, its timing, counters and colors, any temp buffers it keeps state in (fire heat, fade out start), its state objects (life/bouncing balls), the bitmap offsets and the LEDs themselves.
+    // The blob is owned by the caller; ask for the size first, as it depends on the current pattern and what it has allocated.
+    uint32_t getStateSnapshotSize();
+    // Returns the number of bytes written, or 0 if the blob is too small
+    uint32_t snapshotState(void *blob, uint32_t blobSize);
+    // Makes the snapshotted pattern current again and continues it from where it was. Returns false if the blob isn't a snapshot for this strip.
+    bool restoreState(const void *blob, uint32_t blobSize);
 };
 
 
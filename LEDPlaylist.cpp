@@ -0,0 +1,233 @@
+//
+//  LEDPlaylist.cpp
+//  LEDDigitalCyrWheel
+//
+//
+
+#include "LEDPlaylist.h"
+
+#if 1 // DEBUG
+    #define DEBUG_PRINTLN(a) Serial.println(a)
+#else
+    #define DEBUG_PRINTLN(a)
+#endif
+
+#define DEFAULT_PREFETCH_TIME 1000
+
+LEDPlaylist::LEDPlaylist(LEDPatterns *patterns, uint32_t capacity) : m_patterns(patterns), m_capacity(capacity), m_count(0), m_currentIndex(0), m_preparedIndex(capacity), m_entryStartTime(0), m_pauseTime(0), m_prefetchTime(DEFAULT_PREFETCH_TIME), m_started(false), m_shouldLoop(true), m_finished(false) {
+#if SD_CARD_SUPPORT
+    m_nextBitmap = NULL;
+    m_bitmapIndex = capacity;
+#endif
+    m_entries = (LEDPlaylistEntry *)malloc(capacity * sizeof(LEDPlaylistEntry));
+    if (m_entries == NULL) {
+        DEBUG_PRINTLN("not enough RAM for the playlist");
+        m_capacity = 0;
+        m_preparedIndex = 0;
+#if SD_CARD_SUPPORT
+        m_bitmapIndex = 0;
+#endif
+    }
+}
+
+LEDPlaylist::~LEDPlaylist() {
+    discardPrepared();
+    if (m_entries) {
+        free(m_entries);
+    }
+}
+
+bool LEDPlaylist::addEntry(LEDPatternType patternType, uint32_t playDuration, uint32_t patternDuration, CRGB color, LEDPatternOptions options, const char *bitmapFilename) {
+    if (m_count >= m_capacity) {
+        return false;
+    }
+    LEDPlaylistEntry *entry = &m_entries[m_count];
+    entry->patternType = patternType;
+    entry->playDuration = playDuration;
+    entry->patternDuration = patternDuration;
+    entry->color = color;
+    entry->options = options;
+    entry->bitmapFilename = bitmapFilename;
+    m_count++;
+    // What comes after the prepared entry may have changed
+    discardPrepared();
+    return true;
+}
+
+void LEDPlaylist::clear() {
+    discardPrepared();
+#if SD_CARD_SUPPORT
+    m_bitmapIndex = m_capacity;
+#endif
+    m_count = 0;
+    m_currentIndex = 0;
+    m_started = false;
+    m_finished = false;
+}
+
+uint32_t LEDPlaylist::indexAfter(uint32_t index) {
+    if (index + 1 < m_count) {
+        return index + 1;
+    } else if (m_shouldLoop && m_count > 0) {
+        return 0;
+    } else {
+        return m_capacity;
+    }
+}
+
+#if SD_CARD_SUPPORT
+uint32_t LEDPlaylist::bitmapIndexFor(uint32_t index) {
+    if (m_entries[index].bitmapFilename != NULL) {
+        return index;
+    }
+    if (LEDPatterns::PatternIsTransition(m_entries[index].patternType)) {
+        // The pattern it transitions to starts with it
+        uint32_t followingIndex = indexAfter(index);
+        if (followingIndex < m_count && m_entries[followingIndex].bitmapFilename != NULL) {
+            return followingIndex;
+        }
+    }
+    return m_capacity;
+}
+#endif
+
+void LEDPlaylist::discardPrepared() {
+#if SD_CARD_SUPPORT
+    if (m_nextBitmap) {
+        delete m_nextBitmap;
+        m_nextBitmap = NULL;
+    }
+#endif
+    m_preparedIndex = m_capacity;
+}
+
+bool LEDPlaylist::prepareStep(uint32_t index) {
+    if (m_preparedIndex != index) {
+        discardPrepared();
+        m_preparedIndex = index;
+
+        // The allocations are quick, so do them all at once
+        LEDPlaylistEntry *entry = &m_entries[index];
+        m_patterns->preparePatternType(entry->patternType);
+        if (LEDPatterns::PatternIsTransition(entry->patternType)) {
+            // The pattern it transitions to starts with it
+            uint32_t followingIndex = indexAfter(index);
+            if (followingIndex < m_count) {
+                m_patterns->preparePatternType(m_entries[followingIndex].patternType);
+            }
+        }
+#if SD_CARD_SUPPORT
+        uint32_t bitmapIndex = bitmapIndexFor(index);
+        // When the transition before it opened this bitmap, it is still loaded
+        if (bitmapIndex < m_count && bitmapIndex != m_bitmapIndex) {
+            // Only parses the header; the data is read in the next steps
+            m_nextBitmap = new CDPatternBitmap(m_entries[bitmapIndex].bitmapFilename);
+            return false;
+        }
+#endif
+        return true;
+    }
+#if SD_CARD_SUPPORT
+    if (m_nextBitmap) {
+        // When the current pattern's bitmap still has the shared buffer, this one loads into a buffer of its own (or waits, if there isn't enough RAM, and the rest is loaded when we switch)
+        return m_nextBitmap->loadStep();
+    }
+#endif
+    return true;
+}
+
+void LEDPlaylist::applyEntry(uint32_t index) {
+    if (m_preparedIndex != index) {
+        prepareStep(index);
+    }
+    LEDPlaylistEntry *entry = &m_entries[index];
+
+    // Set the type first, as a transition snapshots the outgoing pattern with its own color, options and bitmap
+    m_patterns->setPatternType(entry->patternType);
+#if SD_CARD_SUPPORT
+    if (m_nextBitmap) {
+        m_patterns->setBitmap(m_nextBitmap); // it owns it now
+        m_nextBitmap = NULL;
+        m_bitmapIndex = bitmapIndexFor(index);
+    } else if (bitmapIndexFor(index) != m_bitmapIndex) {
+        m_bitmapIndex = m_capacity; // what it has isn't for this entry
+    } else if (m_bitmapIndex < m_count && !LEDPatterns::PatternIsTransition(m_entries[m_currentIndex].patternType) && m_patterns->getBitmap()) {
+        // The same image again, and not coming from a transition that already started it; start it over
+        m_patterns->getBitmap()->moveToStart();
+    }
+#endif
+    m_preparedIndex = m_capacity;
+    m_patterns->setPatternDuration(entry->patternDuration);
+    m_patterns->setPatternColor(entry->color);
+    m_patterns->setPatternOptions(entry->options);
+    if (LEDPatterns::PatternIsTransition(entry->patternType)) {
+        uint32_t followingIndex = indexAfter(index);
+        if (followingIndex < m_count) {
+            m_patterns->setNextPatternType(m_entries[followingIndex].patternType);
+            m_patterns->setNextPatternDuration(m_entries[followingIndex].patternDuration);
+            m_patterns->setNextPatternColor(m_entries[followingIndex].color);
+            m_patterns->setNextPatternOptions(m_entries[followingIndex].options);
+        } else {
+            m_patterns->setNextPatternType(LEDPatternTypeDoNothing);
+            m_patterns->setNextPatternDuration(0);
+            m_patterns->setNextPatternOptions(LEDPatternOptions(0));
+        }
+    }
+
+    m_currentIndex = index;
+    m_entryStartTime = millis();
+}
+
+void LEDPlaylist::start() {
+    m_started = true;
+    m_finished = false;
+    m_pauseTime = 0;
+    if (m_count > 0) {
+        applyEntry(0);
+    }
+}
+
+void LEDPlaylist::next() {
+    if (!m_started) {
+        start();
+        return;
+    }
+    uint32_t nextIndex = indexAfter(m_currentIndex);
+    if (nextIndex < m_count) {
+        applyEntry(nextIndex);
+    } else {
+        m_finished = true;
+    }
+}
+
+void LEDPlaylist::show() {
+    if (m_count > 0 && !m_started) {
+        start();
+    }
+
+    if (m_patterns->isPaused()) {
+        if (m_pauseTime == 0) {
+            m_pauseTime = m_patterns->getPauseTime();
+        }
+        m_patterns->show(); // does nothing, but in case that changes
+        return;
+    } else if (m_pauseTime != 0) {
+        // Push our start time out by however long it was paused
+        m_entryStartTime += millis() - m_pauseTime;
+        m_pauseTime = 0;
+    }
+
+    if (m_started && !m_finished) {
+        LEDPlaylistEntry *entry = &m_entries[m_currentIndex];
+        uint32_t timePassed = millis() - m_entryStartTime;
+        if (timePassed >= entry->playDuration) {
+            next();
+        } else if (entry->playDuration - timePassed <= m_prefetchTime) {
+            uint32_t nextIndex = indexAfter(m_currentIndex);
+            if (nextIndex < m_count) {
+                prepareStep(nextIndex);
+            }
+        }
+    }
+    m_patterns->show();
+}
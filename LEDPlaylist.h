@@ -0,0 +1,80 @@
+//
+//  LEDPlaylist.h
+//  LEDDigitalCyrWheel
+//
+//
+
+#ifndef __LEDDigitalCyrWheel__LEDPlaylist__
+#define __LEDDigitalCyrWheel__LEDPlaylist__
+
+#include "LEDPatterns.h"
+
+// One item in the playlist. The bitmap filename isn't copied, so it has to stay around as long as the entry does.
+typedef struct {
+    LEDPatternType patternType;
+    uint32_t playDuration; // how long the entry is shown, in ms
+    uint32_t patternDuration; // passed to setPatternDuration
+    CRGB color;
+    LEDPatternOptions options;
+    const char *bitmapFilename; // NULL for patterns that don't use a bitmap
+} LEDPlaylistEntry;
+
+// Plays a list of patterns in order, switching on time. While an entry is near its end, the next one is prepared a bit at a time each frame (its temp buffers allocated, its bitmap opened and read in from the SD card), so the switch doesn't stall on the SD card.
+// When an entry is a transition (ie: LEDPatternTypeCrossfade), it goes to the entry after it; that entry's bitmap is set when the transition starts, and kept for it (not opened again) when the transition is done.
+class LEDPlaylist {
+private:
+    LEDPatterns *m_patterns;
+    LEDPlaylistEntry *m_entries;
+    uint32_t m_capacity;
+    uint32_t m_count;
+    uint32_t m_currentIndex;
+    uint32_t m_preparedIndex; // which entry has been prepared; m_capacity when none
+    uint32_t m_entryStartTime;
+    uint32_t m_pauseTime;
+    uint32_t m_prefetchTime;
+#if SD_CARD_SUPPORT
+    CDPatternBitmap *m_nextBitmap;
+    uint32_t m_bitmapIndex; // the entry the patterns' current bitmap was opened for; m_capacity when none
+    // The entry whose bitmap is shown while this one plays; m_capacity when none
+    uint32_t bitmapIndexFor(uint32_t index);
+#endif
+    uint32_t m_started:1;
+    uint32_t m_shouldLoop:1;
+    uint32_t m_finished:1;
+    uint32_t m_reserved:29;
+
+    // Returns m_capacity when there is no next entry
+    uint32_t indexAfter(uint32_t index);
+    // Does the next bit of work to get the entry ready; returns true when it is all done
+    bool prepareStep(uint32_t index);
+    void discardPrepared();
+    void applyEntry(uint32_t index);
+
+public:
+    // The capacity is fixed; entries are malloc'ed up front
+    LEDPlaylist(LEDPatterns *patterns, uint32_t capacity);
+    ~LEDPlaylist();
+
+    // Returns false if it is full
+    bool addEntry(LEDPatternType patternType, uint32_t playDuration, uint32_t patternDuration, CRGB color, LEDPatternOptions options = LEDPatternOptions(0), const char *bitmapFilename = NULL);
+    void clear();
+    inline uint32_t getCount() { return m_count; }
+    inline LEDPlaylistEntry *getEntry(uint32_t index) { return index < m_count ? &m_entries[index] : NULL; }
+
+    // Starts over at the first entry
+    void start();
+    // Goes to the next entry right now
+    void next();
+    inline uint32_t getCurrentIndex() { return m_currentIndex; }
+    // True when the last entry has played and it isn't looping
+    inline bool isFinished() { return m_finished; }
+
+    inline void setShouldLoop(bool shouldLoop) { m_shouldLoop = shouldLoop; }
+    // How long before the end of an entry to start preparing the next one (default is 1 second)
+    inline void setPrefetchTime(uint32_t prefetchTime) { m_prefetchTime = prefetchTime; }
+
+    // Call this instead of LEDPatterns::show(); it advances the playlist and then shows the patterns. Pausing the patterns pauses the playlist.
+    void show();
+};
+
+#endif /* defined(__LEDDigitalCyrWheel__LEDPlaylist__) */
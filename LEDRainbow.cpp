@@ -0,0 +1,21 @@
+//
+//  LEDRainbow.cpp
+//  LEDDigitalCyrWheel
+//
+//
+
+#include "LEDRainbow.h"
+#include "hsv2rgb.h"
+
+static CRGB g_rainbowColors[256];
+static bool g_rainbowColorsMade = false;
+
+const CRGB *LEDRainbow::GetColors() {
+    if (!g_rainbowColorsMade) {
+        for (int hue = 0; hue < 256; hue++) {
+            hsv2rgb_rainbow(CHSV(hue, 255, 255), g_rainbowColors[hue]);
+        }
+        g_rainbowColorsMade = true;
+    }
+    return g_rainbowColors;
+}
@@ -0,0 +1,29 @@
+//
+//  LEDRainbow.h
+//  LEDDigitalCyrWheel
+//
+//
+
+#ifndef __LEDDigitalCyrWheel__LEDRainbow__
+#define __LEDDigitalCyrWheel__LEDRainbow__
+
+#include "Arduino.h"
+#include "FastLED.h"
+
+// The rainbow patterns used to do an hsv2rgb_rainbow for every LED every frame, which at 600 LEDs was most of the frame. Full saturation and value only has 256 colors, so they are made once (the first time they are asked for) and shared by every pattern.
+class LEDRainbow {
+public:
+    // Same as hsv2rgb_rainbow(CHSV(hue, 255, 255)), indexed by the hue
+    static const CRGB *GetColors();
+
+    // Close to hsv2rgb_rainbow(CHSV(hue, 255, value)): it dims by value squared, the same as it does, and keeps what is on from going all the way off
+    static inline CRGB ColorWithValue(const CRGB *colors, uint8_t hue, uint8_t value) {
+        CRGB result = colors[hue];
+        if (value != 255) {
+            result.nscale8_video(scale8_video(value, value));
+        }
+        return result;
+    }
+};
+
+#endif /* defined(__LEDDigitalCyrWheel__LEDRainbow__) */
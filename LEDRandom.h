@@ -0,0 +1,93 @@
+//
+//  LEDRandom.h
+//  LEDDigitalCyrWheel
+//
+//
+
+#ifndef __LEDDigitalCyrWheel__LEDRandom__
+#define __LEDDigitalCyrWheel__LEDRandom__
+
+#include "Arduino.h"
+
+// A small, fast random number generator (xorshift32) to use instead of the Arduino random(), which is slow (a division or two per call) and has one global state. Each pattern gets its own stream, so what one does doesn't change another's numbers, and the whole thing is 4 bytes that can be saved and put back.
+class LEDRandom {
+private:
+    uint32_t m_state;
+public:
+    LEDRandom(uint32_t seed = 1) { setSeed(seed); }
+
+    // Scrambles the seed so seeds that are close (1, 2, 3..) still start out far apart. Cheap enough to do every frame to replay a sequence.
+    inline void setSeed(uint32_t seed) {
+        m_state = Mix(seed);
+        if (m_state == 0) {
+            m_state = 0x9E3779B9; // xorshift gets stuck at 0
+        }
+    }
+    // A separate stream for each pattern type from the same seed
+    inline void setStream(uint32_t seed, uint32_t stream) { setSeed(seed ^ Mix(stream + 1)); }
+
+    // The raw state, for snapshots; setState(getState()) picks up exactly where it was
+    inline uint32_t getState() { return m_state; }
+    inline void setState(uint32_t state) { m_state = state ? state : 0x9E3779B9; }
+
+    inline uint32_t next() {
+        uint32_t x = m_state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        m_state = x;
+        return x;
+    }
+    inline uint8_t random8() { return next() >> 24; }
+    inline uint16_t random16() { return next() >> 16; }
+
+    // [0, max) with a multiply instead of a division. Same as the Arduino random(max), including 0 for a max of 0.
+    inline uint32_t random(uint32_t max) {
+        return ((uint64_t)next() * max) >> 32;
+    }
+    // [min, max); like Arduino, returns min if max isn't bigger
+    inline int32_t random(int32_t min, int32_t max) {
+        if (min >= max) {
+            return min;
+        }
+        return min + (int32_t)random((uint32_t)(max - min));
+    }
+
+    // Fills with random bytes, 4 per step of the generator
+    inline void fill(uint8_t *bytes, uint32_t count) {
+        while (count >= 4) {
+            uint32_t r = next();
+            bytes[0] = r;
+            bytes[1] = r >> 8;
+            bytes[2] = r >> 16;
+            bytes[3] = r >> 24;
+            bytes += 4;
+            count -= 4;
+        }
+        if (count > 0) {
+            uint32_t r = next();
+            while (count > 0) {
+                *bytes++ = r;
+                r >>= 8;
+                count--;
+            }
+        }
+    }
+
+    // Stateless: the same (seed, index, step) always gives the same number, so each pixel's value for any frame can be worked out on its own without going through a generator
+    static inline uint32_t Hash(uint32_t seed, uint32_t index, uint32_t step) {
+        return Mix(seed + index * 0x9E3779B9 + step * 0xC2B2AE3D);
+    }
+
+    // murmur3's finalizer; every bit of the input changes about half the bits of the output
+    static inline uint32_t Mix(uint32_t x) {
+        x ^= x >> 16;
+        x *= 0x85EBCA6B;
+        x ^= x >> 13;
+        x *= 0xC2B2AE35;
+        x ^= x >> 16;
+        return x;
+    }
+};
+
+#endif /* defined(__LEDDigitalCyrWheel__LEDRandom__) */